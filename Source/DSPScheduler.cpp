@@ -0,0 +1,364 @@
+/*
+  ==============================================================================
+
+    DSPScheduler.cpp
+    Created: 19 Oct 2026 8:26:44pm
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#include "DSPScheduler.h"
+#include "Trace.h"
+
+
+
+DSPJobGroup::DSPJobGroup(ChunkFunction function, void* context)
+    : chunkFunction(function), chunkContext(context)
+{
+}
+
+DSPJobGroup::~DSPJobGroup()
+{
+    //Stale tickets only need a moment to find out there is nothing left to do
+    while(pendingTickets.load(std::memory_order_acquire) > 0)
+        juce::Thread::yield();
+}
+
+bool DSPJobGroup::runChunk()
+{
+    auto packed = claim.fetch_add(1, std::memory_order_acq_rel);
+    auto chunk = static_cast<juce::uint32>(packed & 0xffffffff);
+    auto numChunks = static_cast<juce::uint32>(packed >> 32);
+
+    if(chunk >= numChunks)
+        return false;
+
+    chunkFunction(chunkContext, static_cast<int>(chunk));
+    remaining.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+bool DSPJobGroup::hasUnclaimedChunks(int atLeast) const
+{
+    auto packed = claim.load(std::memory_order_relaxed);
+    auto chunk = static_cast<juce::int64>(packed & 0xffffffff);
+    auto numChunks = static_cast<juce::int64>(packed >> 32);
+
+    return numChunks - chunk >= atLeast;
+}
+
+//==============================================================================
+bool WorkStealingDeque::push(DSPJobGroup* group)
+{
+    auto b = bottom.load(std::memory_order_relaxed);
+    auto t = top.load(std::memory_order_acquire);
+
+    if(b - t >= capacity)
+        return false;
+
+    items[b & (capacity - 1)].store(group, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+DSPJobGroup* WorkStealingDeque::pop()
+{
+    auto b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top.load(std::memory_order_relaxed);
+
+    if(t > b)
+    {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    auto* group = items[b & (capacity - 1)].load(std::memory_order_relaxed);
+
+    //Last item, race the thieves for it
+    if(t == b)
+    {
+        if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            group = nullptr;
+
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    return group;
+}
+
+DSPJobGroup* WorkStealingDeque::steal()
+{
+    auto t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom.load(std::memory_order_acquire);
+
+    if(t >= b)
+        return nullptr;
+
+    auto* group = items[t & (capacity - 1)].load(std::memory_order_relaxed);
+
+    if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+
+    return group;
+}
+
+//==============================================================================
+InjectionQueue::InjectionQueue()
+{
+    for(size_t i = 0; i < cells.size(); ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool InjectionQueue::push(DSPJobGroup* group)
+{
+    auto position = enqueuePosition.load(std::memory_order_relaxed);
+
+    for(;;)
+    {
+        auto& cell = cells[position & (capacity - 1)];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<juce::int64>(sequence) - static_cast<juce::int64>(position);
+
+        if(difference == 0)
+        {
+            if(enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.group = group;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(difference < 0)
+        {
+            return false; //Full
+        }
+        else
+        {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+DSPJobGroup* InjectionQueue::pop()
+{
+    auto position = dequeuePosition.load(std::memory_order_relaxed);
+
+    for(;;)
+    {
+        auto& cell = cells[position & (capacity - 1)];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<juce::int64>(sequence) - static_cast<juce::int64>(position + 1);
+
+        if(difference == 0)
+        {
+            if(dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                auto* group = cell.group;
+                cell.sequence.store(position + capacity, std::memory_order_release);
+                return group;
+            }
+        }
+        else if(difference < 0)
+        {
+            return nullptr; //Empty
+        }
+        else
+        {
+            position = dequeuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+//==============================================================================
+class DSPScheduler::Worker : public juce::Thread
+{
+public:
+    Worker(DSPScheduler& owner, int workerIndex)
+        : juce::Thread("DSP Worker " + juce::String(workerIndex)), scheduler(owner), index(workerIndex)
+    {
+    }
+
+    ~Worker() override
+    {
+        stopThread(1000);
+    }
+
+    void run() override
+    {
+        DYNCONV_TRACE_REGISTER_THREAD();
+
+        //Spin for a little while before sleeping, blocks tend to arrive in bursts
+        constexpr int spinRounds = 64;
+        constexpr int sleepTimeoutMs = 10;
+        auto idleRounds = 0;
+
+        while(!threadShouldExit())
+        {
+            if(auto* group = scheduler.findWork(index))
+            {
+                scheduler.execute(index, *group);
+                idleRounds = 0;
+                continue;
+            }
+
+            if(++idleRounds < spinRounds)
+            {
+                juce::Thread::yield();
+                continue;
+            }
+
+            sleeping.store(true);
+            scheduler.numSleeping.fetch_add(1);
+
+            //Check again, work pushed before the flag was visible would not wake us
+            if(auto* group = scheduler.findWork(index))
+            {
+                sleeping.store(false);
+                scheduler.numSleeping.fetch_sub(1);
+                scheduler.execute(index, *group);
+                continue;
+            }
+
+            wait(sleepTimeoutMs);
+
+            sleeping.store(false);
+            scheduler.numSleeping.fetch_sub(1);
+            idleRounds = 0;
+        }
+    }
+
+    WorkStealingDeque deque;
+    std::atomic<bool> sleeping {false};
+
+private:
+    DSPScheduler& scheduler;
+    const int index;
+};
+
+//==============================================================================
+DSPScheduler::DSPScheduler()
+{
+    //Leave one core for the host threads that submit the work
+    auto numWorkers = juce::jlimit(1, 16, juce::SystemStats::getNumCpus() - 1);
+
+    for(auto i = 0; i < numWorkers; ++i)
+        workers.push_back(std::make_unique<Worker>(*this, i));
+
+    for(auto& worker : workers)
+    {
+        if(!worker->startRealtimeThread(juce::Thread::RealtimeOptions{}.withPriority(8)))
+            worker->startThread(juce::Thread::Priority::highest);
+    }
+}
+
+DSPScheduler::~DSPScheduler()
+{
+    for(auto& worker : workers)
+        worker->signalThreadShouldExit();
+
+    for(auto& worker : workers)
+        worker->stopThread(1000);
+
+    //Release tickets nobody picked up, so their groups can be destroyed
+    while(auto* group = injectionQueue.pop())
+        group->pendingTickets.fetch_sub(1, std::memory_order_release);
+
+    for(auto& worker : workers)
+        while(auto* group = worker->deque.pop())
+            group->pendingTickets.fetch_sub(1, std::memory_order_release);
+}
+
+void DSPScheduler::run(DSPJobGroup& group, int numChunks)
+{
+    if(numChunks <= 0)
+        return;
+
+    group.remaining.store(numChunks, std::memory_order_relaxed);
+    group.claim.store(static_cast<juce::uint64>(numChunks) << 32, std::memory_order_release);
+
+    //One ticket per worker that could help, the caller takes the first chunk itself
+    auto numTickets = std::min(numChunks - 1, getNumWorkers());
+
+    for(auto i = 0; i < numTickets; ++i)
+    {
+        group.pendingTickets.fetch_add(1, std::memory_order_relaxed);
+
+        if(!injectionQueue.push(&group))
+        {
+            group.pendingTickets.fetch_sub(1, std::memory_order_relaxed);
+            numTickets = i;
+            break;
+        }
+    }
+
+    wakeWorkers(numTickets);
+
+    while(group.runChunk())
+    {
+    }
+
+    //Every chunk is claimed now, so this only waits for chunks already running on a worker
+    while(group.remaining.load(std::memory_order_acquire) > 0)
+        juce::Thread::yield();
+}
+
+DSPJobGroup* DSPScheduler::findWork(int workerIndex)
+{
+    if(auto* group = workers[workerIndex]->deque.pop())
+        return group;
+
+    if(auto* group = injectionQueue.pop())
+        return group;
+
+    auto numWorkers = getNumWorkers();
+    for(auto i = 1; i < numWorkers; ++i)
+    {
+        if(auto* group = workers[(workerIndex + i) % numWorkers]->deque.steal())
+            return group;
+    }
+
+    return nullptr;
+}
+
+void DSPScheduler::execute(int workerIndex, DSPJobGroup& group)
+{
+    //Leave a ticket behind for idle workers to steal while this one is busy
+    if(group.hasUnclaimedChunks(2))
+    {
+        group.pendingTickets.fetch_add(1, std::memory_order_relaxed);
+
+        if(workers[workerIndex]->deque.push(&group))
+            wakeWorkers(1);
+        else
+            group.pendingTickets.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    while(group.runChunk())
+    {
+    }
+
+    group.pendingTickets.fetch_sub(1, std::memory_order_release);
+}
+
+void DSPScheduler::wakeWorkers(int numToWake)
+{
+    if(numToWake <= 0 || numSleeping.load() == 0)
+        return;
+
+    for(auto& worker : workers)
+    {
+        if(numToWake == 0)
+            break;
+
+        if(worker->sleeping.load())
+        {
+            worker->notify();
+            --numToWake;
+        }
+    }
+}
@@ -0,0 +1,122 @@
+/*
+  ==============================================================================
+
+    DSPScheduler.h
+    Created: 19 Oct 2026 8:26:44pm
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+//A batch of chunks run across the scheduler's workers and the calling thread
+//Owned by one engine and reused every block, so nothing is allocated while processing
+class DSPJobGroup
+{
+public:
+    using ChunkFunction = void (*)(void* context, int chunk);
+
+    DSPJobGroup(ChunkFunction function, void* context);
+    ~DSPJobGroup();
+
+private:
+    friend class DSPScheduler;
+
+    //Claims and runs one chunk, returns false once every chunk has been claimed
+    bool runChunk();
+    bool hasUnclaimedChunks(int atLeast) const;
+
+    ChunkFunction chunkFunction;
+    void* chunkContext;
+
+    //Chunk count in the upper 32 bits, next unclaimed chunk in the lower 32,
+    //so a claim always sees the count of the batch it belongs to
+    std::atomic<juce::uint64> claim {0};
+    std::atomic<int> remaining {0};
+
+    //Tickets for this group still sitting in a queue or being run, the group can't go away before they're done
+    std::atomic<int> pendingTickets {0};
+
+    JUCE_DECLARE_NON_COPYABLE(DSPJobGroup)
+};
+
+
+//Chase-Lev deque, the owning worker pushes and pops at the bottom, other workers steal from the top
+class WorkStealingDeque
+{
+public:
+    bool push(DSPJobGroup* group);
+    DSPJobGroup* pop();
+    DSPJobGroup* steal();
+
+private:
+    static constexpr int capacity = 256;
+
+    std::array<std::atomic<DSPJobGroup*>, capacity> items {};
+    std::atomic<juce::int64> top {0};
+    std::atomic<juce::int64> bottom {0};
+};
+
+
+//Bounded multi-producer multi-consumer queue, used by the host threads to hand work to the workers
+class InjectionQueue
+{
+public:
+    InjectionQueue();
+
+    bool push(DSPJobGroup* group);
+    DSPJobGroup* pop();
+
+private:
+    static constexpr int capacity = 1024;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence {0};
+        DSPJobGroup* group = nullptr;
+    };
+
+    std::array<Cell, capacity> cells;
+    std::atomic<size_t> enqueuePosition {0};
+    std::atomic<size_t> dequeuePosition {0};
+};
+
+
+//Process-wide pool of realtime worker threads, shared by every convolver instance
+//through juce::SharedResourcePointer, so it is created with the first instance and
+//destroyed with the last
+class DSPScheduler
+{
+public:
+    DSPScheduler();
+    ~DSPScheduler();
+
+    //Runs chunks 0 to numChunks - 1 of the group and returns once all of them have finished
+    //The calling thread works through the chunks as well, so it only ever waits for chunks
+    //that a worker has already started, never for a worker to become free
+    void run(DSPJobGroup& group, int numChunks);
+
+    int getNumWorkers() const { return static_cast<int>(workers.size()); }
+
+private:
+    class Worker;
+
+    DSPJobGroup* findWork(int workerIndex);
+    void execute(int workerIndex, DSPJobGroup& group);
+    void wakeWorkers(int numToWake);
+
+    InjectionQueue injectionQueue;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> numSleeping {0};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DSPScheduler)
+};
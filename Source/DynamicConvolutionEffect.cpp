@@ -9,80 +9,774 @@
 */
 
 #include "DynamicConvolutionEffect.h"
+#include "Trace.h"
 
 
 
+class DynamicConvolutionEffect::Rebuilder : public juce::Thread
+{
+public:
+    explicit Rebuilder(DynamicConvolutionEffect& owner)
+        : juce::Thread("IR Re-partitioner"), effect(owner)
+    {
+        startThread();
+    }
+    
+    ~Rebuilder() override
+    {
+        signalThreadShouldExit();
+        notify();
+        stopThread(4000);
+    }
+    
+    void run() override
+    {
+        DYNCONV_TRACE_REGISTER_THREAD();
+        
+        while(!threadShouldExit())
+        {
+            //Loads first, they're what the user is waiting on
+            auto didWork = effect.buildQueuedLoads();
+            didWork = effect.buildSpareEngines() || didWork;
+            
+            //A pair still playing out its tail isn't free yet, so a waiting request looks again shortly
+            if(!didWork)
+                wait(effect.requestedBlockSize.load() > 0 ? 10 : -1);
+        }
+    }
+    
+private:
+    DynamicConvolutionEffect& effect;
+};
+
+//==============================================================================
 DynamicConvolutionEffect::DynamicConvolutionEffect(juce::AudioProcessorValueTreeState& vts)
 {
-    formatManager.registerBasicFormats();
     convEngine = std::make_unique<DynamicConvolverV2>(vts);
     convEngineR = std::make_unique<DynamicConvolverV2>(vts);
+    convEngine->setScheduler(&scheduler.getObject());
+    convEngineR->setScheduler(&scheduler.getObject());
+    
+    //Only prepared and shaped while they're rebuilt or playing out a tail
+    spareEngine = std::make_unique<DynamicConvolverV2>(vts);
+    spareEngineR = std::make_unique<DynamicConvolverV2>(vts);
+    spareEngine->setScheduler(&scheduler.getObject());
+    spareEngineR->setScheduler(&scheduler.getObject());
+    
+    offlineEngine = std::make_unique<DynamicConvolverV2>(vts);
+    offlineEngineR = std::make_unique<DynamicConvolverV2>(vts);
+    offlineEngine->setScheduler(&scheduler.getObject());
+    offlineEngineR->setScheduler(&scheduler.getObject());
+    
+    for(auto* engine : {convEngine.get(), convEngineR.get(), offlineEngine.get(), offlineEngineR.get()})
+        shaper.addEngine(engine);
+    
+    irLoader.addChangeListener(this);
+    
+    slotAParameter = vts.getRawParameterValue("SLOT_A");
+    slotBParameter = vts.getRawParameterValue("SLOT_B");
+    morphParameter = vts.getRawParameterValue("MORPH");
+    captureParameter = vts.getRawParameterValue("CAPTURE");
+    
+    for(auto* engine : {convEngine.get(), convEngineR.get(), spareEngine.get(), spareEngineR.get(), offlineEngine.get(), offlineEngineR.get()})
+        engine->setMemoryBudget(&memoryBudget.getObject());
+    
+    rebuilder = std::make_unique<Rebuilder>(*this);
+}
+
+juce::AudioProcessorValueTreeState::ParameterLayout DynamicConvolutionEffect::createParameterLayout()
+{
+    int versionHint = 1;
+    
+    using namespace juce;
+    
+    return
+    {
+        std::make_unique<AudioParameterFloat>(ParameterID {"FILE_LEN", versionHint}, "File Length", 0.0f, 1.0f, 1.0f),
+        std::make_unique<AudioParameterFloat> (ParameterID{"FILE_POS", versionHint},  "File Pos", 0.0f, 1.0f, 0.0f),
+        std::make_unique<AudioParameterFloat>(ParameterID {"DRY_WET", versionHint},
+                                              "Dry/Wet", 0.0f, 1.0f, 0.5f),
+        std::make_unique<AudioParameterInt>(ParameterID {"SLOT_A", versionHint}, "Slot A", 1, DynamicConvolverV2::numSlots, 1),
+        std::make_unique<AudioParameterInt>(ParameterID {"SLOT_B", versionHint}, "Slot B", 1, DynamicConvolverV2::numSlots, 2),
+        std::make_unique<AudioParameterFloat>(ParameterID {"MORPH", versionHint}, "Morph", 0.0f, 1.0f, 0.0f),
+        std::make_unique<AudioParameterBool>(ParameterID {"CAPTURE", versionHint}, "Capture", false),
+        std::make_unique<AudioParameterBool>(ParameterID {"REVERSE", versionHint}, "Reverse", false),
+        
+        //IR shaping, the cuts are off at the ends of their ranges
+        std::make_unique<AudioParameterFloat>(ParameterID {"LOW_CUT", versionHint}, "Low Cut",
+                                              NormalisableRange<float>(20.0f, 2000.0f, 0.0f, 0.3f), 20.0f),
+        std::make_unique<AudioParameterFloat>(ParameterID {"HIGH_CUT", versionHint}, "High Cut",
+                                              NormalisableRange<float>(1000.0f, 20000.0f, 0.0f, 0.3f), 20000.0f),
+        std::make_unique<AudioParameterFloat>(ParameterID {"TILT", versionHint}, "Tilt", -6.0f, 6.0f, 0.0f),
+        std::make_unique<AudioParameterFloat>(ParameterID {"DAMPING", versionHint}, "Damping", 0.0f, 1.0f, 0.0f)
+    };
 }
 
-void DynamicConvolutionEffect::prepare(int buffsize)
+DynamicConvolutionEffect::~DynamicConvolutionEffect()
 {
-    convEngine->prepare(buffsize);
-    convEngineR->prepare(buffsize);
+    rebuilder.reset();
+    irLoader.removeChangeListener(this);
+    cancelPendingUpdate();
+    
+    for(auto* engine : {convEngine.get(), convEngineR.get(), spareEngine.get(), spareEngineR.get(), offlineEngine.get(), offlineEngineR.get()})
+        shaper.removeEngine(engine);
 }
 
-void DynamicConvolutionEffect::loadFileAsIR(juce::File newFile)
+void DynamicConvolutionEffect::prepare(double sampleRate, int buffsize, bool nonRealtime)
 {
-    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(newFile));
+    //Shaping curves are worked out in Hz, and rebuilt in the background, the partitions don't depend on the sample rate
+    for(auto* engine : {convEngine.get(), convEngineR.get(), spareEngine.get(), spareEngineR.get(), offlineEngine.get(), offlineEngineR.get()})
+        engine->setSampleRate(sampleRate);
+    
+    preparedBlockSize = buffsize;
+    preparedSampleRate = sampleRate;
+    
+    for(auto& ringOutBuffer : ringOutBuffers)
+        ringOutBuffer.assign(static_cast<size_t>(buffsize), 0.0f);
     
-    if(reader == nullptr)
     {
-        juce::Logger::writeToLog("Error: IR failed to load...\n");
+        const juce::ScopedLock sl(engineLock);
+        auto blockSizeToBuild = 0;
+        
+        //First prepare, or a capture that is still running, which carries on with the new block size in the same engines
+        if(engineBlockSize == 0 || isCapturing.load())
+        {
+            convEngine->prepare(buffsize);
+            convEngineR->prepare(buffsize);
+            engineBlockSize = buffsize;
+        }
+        else
+        {
+            //The engines take blocks of any length, so they keep their partitions until the new ones are swapped in
+            convEngine->reset();
+            convEngineR->reset();
+            
+            if(buffsize != engineBlockSize)
+                blockSizeToBuild = buffsize;
+        }
+        
+        //A pair built for another block size must not be swapped in
+        if(spareState.load() == SpareState::ready)
+        {
+            if(spareBlockSize == buffsize && blockSizeToBuild != 0)
+                blockSizeToBuild = 0;
+            else if(blockSizeToBuild == 0)
+                releaseSpareEngines();
+            else
+                spareState.store(SpareState::building);
+        }
+        
+        requestedBlockSize.store(blockSizeToBuild);
+    }
+    
+    rebuilder->notify();
+    setOfflineMode(nonRealtime);
+    sendChangeMessage();
+}
+
+int DynamicConvolutionEffect::getLatencySamples() const
+{
+    return isOffline.load() ? offlinePartitionSize : 0;
+}
+
+void DynamicConvolutionEffect::setNonRealtime(bool nonRealtime)
+{
+    //Before the first prepare() there's no block size to build the offline engines for, prepare() switches then
+    if(preparedBlockSize > 0 && nonRealtime != isOffline.load())
+    {
+        setOfflineMode(nonRealtime);
+        
+        //The offline pair may hold less of each IR, the editor shows what's cut
+        sendChangeMessage();
+    }
+}
+
+void DynamicConvolutionEffect::setOfflineMode(bool shouldBeOffline)
+{
+    if(!shouldBeOffline)
+    {
+        if(isOffline.exchange(false))
+            isRealtimeResetPending.store(true);
+        
         return;
     }
     
-    auto totalIrLength = reader->lengthInSamples;
+    //Same longest IR as the realtime engines, in fewer and larger partitions
+    auto capacity = (DynamicConvolverV2::maxPartitions * preparedBlockSize + offlinePartitionSize - 1) / offlinePartitionSize;
+    
+    //Windows are cut on the realtime grid, so a bounce sounds exactly like playback
+    offlineEngine->setWindowGrid(preparedBlockSize);
+    offlineEngineR->setWindowGrid(preparedBlockSize);
+    offlineEngine->prepare(offlinePartitionSize, capacity);
+    offlineEngineR->prepare(offlinePartitionSize, capacity);
+    
+    {
+        //The audio thread may still swap in a spare pair until the switch
+        const juce::ScopedLock sl(engineLock);
+        offlineEngine->copyIRsFrom(*convEngine);
+        offlineEngineR->copyIRsFrom(*convEngineR);
+    }
     
-    int numChannels = reader->numChannels;
+    for(auto ch = 0; ch < 2; ++ch)
+    {
+        offlineInput[ch].assign(offlinePartitionSize, 0.0f);
+        offlineOutput[ch].assign(offlinePartitionSize, 0.0f);
+    }
     
+    offlineFifoPosition = 0;
+    wasOfflineStereo = false;
+    wasOfflineWindowSteady = false;
+    isOfflineStartPending = true;
     
-    isIrStereo = numChannels == 2 ? true : false;
+    //At most one change per sample of the partition
+    offlineChanges.clear();
+    offlineChanges.reserve(offlinePartitionSize);
+    offlineChanges.push_back({0, offlineEngine->getWindowParameters()});
+    isOffline.store(true);
+}
+
+void DynamicConvolutionEffect::loadFileAsIR(juce::File newFile, int slot)
+{
+    //Decoding happens on the loader thread, the result comes back through changeListenerCallback
+    irLoader.loadAsync(newFile, slot);
+}
+
+void DynamicConvolutionEffect::changeListenerCallback(juce::ChangeBroadcaster* source)
+{
+    if(source == &irLoader)
+    {
+        //Only the slots the loader has a new decode for, a slot that was captured since keeps its capture
+        for(auto slot = 0; slot < DynamicConvolverV2::numSlots; ++slot)
+        {
+            auto decoded = irLoader.getLoadedIR(slot);
+            
+            if(decoded != decodedIRs[slot])
+            {
+                decodedIRs[slot] = decoded;
+                loadIR(std::move(decoded), slot);
+            }
+        }
+    }
+}
+
+void DynamicConvolutionEffect::loadIR(std::shared_ptr<const LoadedIR> newIR, int slot)
+{
+    if(newIR == nullptr || newIR == currentIRs[slot])
+        return;
     
-    IRdata.resize(static_cast<size_t>(totalIrLength));
+    {
+        //A newer load for the slot replaces one that hasn't been built yet
+        const juce::ScopedLock sl(loadLock);
+        queuedIRs[slot] = std::move(newIR);
+    }
     
-    IRbuffer.setSize(numChannels, (int)reader->lengthInSamples);
+    rebuilder->notify();
+}
+
+bool DynamicConvolutionEffect::buildQueuedLoads()
+{
+    auto didWork = false;
     
-    reader->read(&IRbuffer, 0, static_cast<int>(reader->lengthInSamples), 0, true, true);
+    for(auto slot = 0; slot < DynamicConvolverV2::numSlots; ++slot)
+    {
+        std::shared_ptr<const LoadedIR> newIR;
+        
+        {
+            const juce::ScopedLock sl(loadLock);
+            std::swap(newIR, queuedIRs[slot]);
+        }
+        
+        if(newIR != nullptr)
+        {
+            buildLoad(std::move(newIR), slot);
+            didWork = true;
+        }
+    }
     
-    normalizeFile();
+    return didWork;
+}
 
-    auto span = std::span<const float>(IRbuffer.getReadPointer(0), IRbuffer.getNumSamples());
+void DynamicConvolutionEffect::buildLoad(std::shared_ptr<const LoadedIR> newIR, int slot)
+{
+    auto& irBuffer = newIR->buffer;
     
-    convEngine->loadNewIR(span);
+    auto isStereo = irBuffer.getNumChannels() == 2 ? true : false;
+
+    auto span = std::span<const float>(irBuffer.getReadPointer(0), irBuffer.getNumSamples());
     
     //IF stereo IR file, load second channel into second convolution engine
-    if (isIrStereo) {
-        convEngineR->loadNewIR(std::span<const float>(IRbuffer.getReadPointer(1), IRbuffer.getNumSamples()));
+    //Mono IRs are loaded into both, so a stereo slot can morph into a mono one
+    auto spanR = isStereo ? std::span<const float>(irBuffer.getReadPointer(1), irBuffer.getNumSamples()) : span;
+    
+    const juce::ScopedLock sl(engineLock);
+    
+    //Refused while the slot is being captured, both are tried so neither is left behind
+    auto loadedL = convEngine->loadNewIR(span, slot);
+    auto loadedR = convEngineR->loadNewIR(spanR, slot);
+    
+    if(!loadedL || !loadedR)
+    {
+        const juce::ScopedLock loads(loadLock);
+        pendingIRs[slot] = std::move(newIR);
+        return;
     }
+    
+    //A pair waiting to be swapped in needs it too, one still being built copies it from the pair playing
+    if(spareState.load() == SpareState::ready)
+    {
+        spareEngine->loadNewIR(span, slot);
+        spareEngineR->loadNewIR(spanR, slot);
+    }
+    
+    //A render already running picks up the new IR too
+    if(isOffline.load())
+    {
+        offlineEngine->loadNewIR(span, slot);
+        offlineEngineR->loadNewIR(spanR, slot);
+    }
+    
+    isIrStereo[slot].store(isStereo);
+    
+    {
+        //A file picked for the slot before this one was waiting for the same capture, and this replaces it
+        const juce::ScopedLock loads(loadLock);
+        pendingIRs[slot] = nullptr;
+        builtIRs[slot] = std::move(newIR);
+    }
+    
+    triggerAsyncUpdate();
+}
 
+std::shared_ptr<const LoadedIR> DynamicConvolutionEffect::createCapturedIR(int slot) const
+{
+    auto left = convEngine->getIRData(slot);
+    auto right = convEngineR->getIRData(slot);
+    auto numSamples = static_cast<int>(std::min(left.size(), right.size()));
+    
+    //Nothing was recorded, the slot is as empty as one nothing was loaded into
+    if(numSamples == 0)
+        return nullptr;
+    
+    auto captured = std::make_shared<LoadedIR>();
+    captured->sampleRate = preparedSampleRate;
+    captured->buffer.setSize(isIrStereo[slot].load() ? 2 : 1, numSamples);
+    captured->buffer.copyFrom(0, 0, left.data(), numSamples);
+    
+    if(captured->buffer.getNumChannels() > 1)
+        captured->buffer.copyFrom(1, 0, right.data(), numSamples);
+    
+    captured->peaks.build(captured->buffer);
+    return captured;
 }
 
+void DynamicConvolutionEffect::handleAsyncUpdate()
+{
+    //Loads the rebuilder has built are playing already, so this only hands them over to the editor
+    auto wasLoaded = false;
+    
+    {
+        const juce::ScopedLock loads(loadLock);
+        
+        for(auto slot = 0; slot < DynamicConvolverV2::numSlots; ++slot)
+        {
+            if(builtIRs[slot] != nullptr)
+            {
+                currentIRs[slot] = std::move(builtIRs[slot]);
+                wasLoaded = true;
+            }
+        }
+    }
+    
+    if(wasLoaded)
+        sendChangeMessage();
+    
+    const juce::ScopedLock sl(engineLock);
+    
+    //Capture has ended, hand the recorded samples over to the slots
+    if(isCommitPending.load())
+    {
+        convEngine->commitCapture();
+        convEngineR->commitCapture();
+        
+        if(spareState.load() == SpareState::ready)
+        {
+            spareEngine->copyIRsFrom(*convEngine);
+            spareEngineR->copyIRsFrom(*convEngineR);
+        }
+        
+        if(isOffline.load())
+        {
+            offlineEngine->copyIRsFrom(*convEngine);
+            offlineEngineR->copyIRsFrom(*convEngineR);
+        }
+        
+        //The slot plays the capture now, so that's what the editor draws
+        currentIRs[capturingSlot] = createCapturedIR(capturingSlot);
+        isCommitPending.store(false);
+        sendChangeMessage();
+        
+        //Files picked for the slot while it was being captured replace the capture now, unless a newer one is queued
+        {
+            const juce::ScopedLock loads(loadLock);
+            
+            for(auto slot = 0; slot < DynamicConvolverV2::numSlots; ++slot)
+            {
+                if(pendingIRs[slot] != nullptr && queuedIRs[slot] == nullptr)
+                    queuedIRs[slot] = std::move(pendingIRs[slot]);
+                
+                pendingIRs[slot] = nullptr;
+            }
+        }
+        
+        rebuilder->notify();
+    }
+    
+    //The pair swapped out has played its tail, the pair playing now may hold more or less of each IR
+    if(spareState.load() == SpareState::retired)
+    {
+        releaseSpareEngines();
+        sendChangeMessage();
+    }
+}
+
+bool DynamicConvolutionEffect::buildSpareEngines()
+{
+    auto blockSize = requestedBlockSize.load();
+    if(blockSize == 0)
+        return false;
+    
+    {
+        const juce::ScopedLock sl(engineLock);
+        auto state = spareState.load();
+        
+        if(state == SpareState::ringing || state == SpareState::retired)
+            return false;
+        
+        spareState.store(SpareState::building);
+    }
+    
+    //Nothing plays a pair that is building, so it's prepared without the lock
+    for(auto* engine : {spareEngine.get(), spareEngineR.get()})
+    {
+        shaper.removeEngine(engine);
+        engine->prepare(blockSize);
+        shaper.addEngine(engine);
+    }
+    
+    const juce::ScopedLock sl(engineLock);
+    
+    //IRs loaded in the meantime went to the pair playing, so they're copied from there
+    spareEngine->copyIRsFrom(*convEngine);
+    spareEngineR->copyIRsFrom(*convEngineR);
+    
+    if(requestedBlockSize.compare_exchange_strong(blockSize, 0))
+    {
+        spareBlockSize = blockSize;
+        spareState.store(SpareState::ready);
+    }
+    else if(blockSize == 0)
+    {
+        //Back to the block size that's playing, nothing to swap
+        releaseSpareEngines();
+    }
+    
+    //Otherwise another block size was asked for meanwhile, and the next call builds that
+    return true;
+}
+
+void DynamicConvolutionEffect::swapInSpareEngines()
+{
+    //A capture records into the pair playing, it's swapped once the capture has been handed over
+    if(spareState.load() != SpareState::ready || isCapturing.load() || isCommitPending.load())
+        return;
+    
+    //Never waits, the swap is tried again on the next block
+    const juce::ScopedTryLock tl(engineLock);
+    if(!tl.isLocked() || spareState.load() != SpareState::ready)
+        return;
+    
+    std::swap(convEngine, spareEngine);
+    std::swap(convEngineR, spareEngineR);
+    std::swap(engineBlockSize, spareBlockSize);
+    
+    //A right engine that wasn't being fed has nothing current to ring out
+    if(!wasStereo)
+        spareEngineR->reset();
+    
+    ringOutRemaining = std::max(spareEngine->getTailLength(), spareEngineR->getTailLength());
+    spareState.store(SpareState::ringing);
+}
+
+void DynamicConvolutionEffect::ringOutSpareEngines(juce::AudioBuffer<float>& buffer, const DynamicConvolverV2::WindowParameters& parameters, bool stereo)
+{
+    //The input since the swap is in the new pair, so the old one only has to finish what it already heard
+    //Hosts may send more than the block size they prepared with, so it's played out in chunks of that
+    auto chunkSize = static_cast<int>(ringOutBuffers[0].size());
+    
+    for(auto start = 0; start < buffer.getNumSamples() && chunkSize > 0; start += chunkSize)
+    {
+        auto numSamples = std::min(chunkSize, buffer.getNumSamples() - start);
+        
+        for(auto ch = 0; ch < (stereo ? 2 : 1); ++ch)
+        {
+            auto* engine = ch == 0 ? spareEngine.get() : spareEngineR.get();
+            auto* silence = ringOutBuffers[ch].data();
+            
+            juce::FloatVectorOperations::clear(silence, numSamples);
+            engine->process(std::span<float>(silence, static_cast<size_t>(numSamples)), parameters);
+            juce::FloatVectorOperations::add(buffer.getWritePointer(ch) + start, silence, numSamples);
+        }
+        
+        ringOutRemaining -= numSamples;
+    }
+    
+    if(ringOutRemaining <= 0)
+    {
+        spareState.store(SpareState::retired);
+        triggerAsyncUpdate();
+    }
+}
+
+void DynamicConvolutionEffect::releaseSpareEngines()
+{
+    for(auto* engine : {spareEngine.get(), spareEngineR.get()})
+    {
+        shaper.removeEngine(engine);
+        engine->release();
+    }
+    
+    spareState.store(SpareState::idle);
+}
+
+size_t DynamicConvolutionEffect::getMemoryBytes() const
+{
+    size_t bytes = 0;
+    for(auto* engine : {convEngine.get(), convEngineR.get(), spareEngine.get(), spareEngineR.get(), offlineEngine.get(), offlineEngineR.get()})
+        bytes += engine->getMemoryBytes();
+    
+    return bytes;
+}
 
-void DynamicConvolutionEffect::processBlock(juce::AudioBuffer<float> buffer)
+int DynamicConvolutionEffect::getNumDroppedSamples(int slot) const
 {
+    //The audio thread swaps the pair playing under this lock
+    const juce::ScopedLock sl(engineLock);
+    auto numDropped = std::max(convEngine->getNumDroppedSamples(slot), convEngineR->getNumDroppedSamples(slot));
+    
+    //A bounce plays the offline pair, which can hold less within the budget
+    if(isOffline.load())
+        numDropped = std::max({numDropped, offlineEngine->getNumDroppedSamples(slot), offlineEngineR->getNumDroppedSamples(slot)});
+    
+    return numDropped;
+}
+
+bool DynamicConvolutionEffect::isSameWindow(DynamicConvolverV2::WindowParameters a, const DynamicConvolverV2::WindowParameters& b)
+{
+    //The mix is applied to the output, the rest decides what the MAC pass plays
+    a.dryWet = b.dryWet;
+    return a == b;
+}
+
+int DynamicConvolutionEffect::getSlotParameter(const std::atomic<float>* parameter) const
+{
+    return juce::jlimit(0, DynamicConvolverV2::numSlots - 1, juce::roundToInt(parameter->load()) - 1);
+}
+
+bool DynamicConvolutionEffect::needsStereoProcessing() const
+{
+    auto slotA = getSlotParameter(slotAParameter);
+    auto slotB = getSlotParameter(slotBParameter);
+    
+    return isIrStereo[slotA].load() || (morphParameter->load() > 0.0f && isIrStereo[slotB].load());
+}
+
+
+void DynamicConvolutionEffect::updateCapture(const juce::AudioBuffer<float>& sidechain)
+{
+    auto shouldCapture = captureParameter->load() >= 0.5f && sidechain.getNumChannels() > 0;
+    
+    if(shouldCapture && !isCapturing.load())
+    {
+        //Fails until the previous capture has been committed, the next block tries again
+        //Loads hold the lock for both engines, so with it neither is building in the slot a capture records into
+        auto slot = getSlotParameter(slotAParameter);
+        const juce::ScopedTryLock tl(engineLock);
+        
+        if(tl.isLocked() && convEngine->beginCapture(slot) && convEngineR->beginCapture(slot))
+        {
+            isIrStereo[slot].store(sidechain.getNumChannels() > 1);
+            capturingSlot = slot;
+            isCapturing.store(true);
+        }
+    }
+    else if(!shouldCapture && isCapturing.load())
+    {
+        convEngine->endCapture();
+        convEngineR->endCapture();
+        isCapturing.store(false);
+        isCommitPending.store(true);
+        triggerAsyncUpdate();
+    }
+    
+    if(isCapturing.load())
+    {
+        auto numSamples = sidechain.getNumSamples();
+        convEngine->captureBlock(std::span<const float>(sidechain.getReadPointer(0), numSamples));
+        convEngineR->captureBlock(std::span<const float>(sidechain.getReadPointer(sidechain.getNumChannels() > 1 ? 1 : 0), numSamples));
+    }
+}
+
+void DynamicConvolutionEffect::processBlock(juce::AudioBuffer<float> buffer, juce::AudioBuffer<float> sidechain)
+{
+    //The realtime engines sat idle during the render, drop their stale history, and any tail left to play
+    if(!isOffline.load() && isRealtimeResetPending.exchange(false))
+    {
+        convEngine->reset();
+        convEngineR->reset();
+        
+        if(spareState.load() == SpareState::ringing)
+        {
+            spareState.store(SpareState::retired);
+            triggerAsyncUpdate();
+        }
+    }
+    
+    if(!isOffline.load())
+        swapInSpareEngines();
+    
+    //Captured first, so the newest partition is already part of this block's window
+    updateCapture(sidechain);
+    
     //Copy input in channel 1 to channel 2 to avoid stereo processing issues
     juce::FloatVectorOperations::copy(buffer.getWritePointer(1), buffer.getReadPointer(0), buffer.getNumSamples());
     
+    if(isOffline.load())
+    {
+        processOffline(buffer);
+        return;
+    }
+    
+    //One snapshot for both channels, so they switch on the same sample
+    auto parameters = convEngine->getWindowParameters();
+    auto stereo = buffer.getNumChannels() > 1 && needsStereoProcessing();
+    
     auto span = std::span<float>(buffer.getWritePointer(0), buffer.getNumSamples());
-    convEngine->process(span);
+    convEngine->process(span, parameters);
     
-    if (buffer.getNumChannels() > 1) {
-        if(isIrStereo)
-            convEngineR->process(std::span<float>(buffer.getWritePointer(1), buffer.getNumSamples()));
-        else
-            juce::FloatVectorOperations::copy(buffer.getWritePointer(1), buffer.getReadPointer(0), buffer.getNumSamples());
-    }
+    //The right engine isn't fed while the slots are mono, so it drops what it heard before that
+    if(stereo && !wasStereo)
+        convEngineR->reset();
+    
+    wasStereo = stereo;
+    
+    if(stereo)
+        convEngineR->process(std::span<float>(buffer.getWritePointer(1), buffer.getNumSamples()), parameters);
+    
+    if(spareState.load() == SpareState::ringing)
+        ringOutSpareEngines(buffer, parameters, stereo);
+    
+    if(buffer.getNumChannels() > 1 && !stereo)
+        juce::FloatVectorOperations::copy(buffer.getWritePointer(1), buffer.getReadPointer(0), buffer.getNumSamples());
 
     
 }
 
-void DynamicConvolutionEffect::normalizeFile()
+void DynamicConvolutionEffect::processOffline(juce::AudioBuffer<float>& buffer)
 {
-    auto numSamps = IRbuffer.getNumSamples();
-    auto mag = IRbuffer.getMagnitude(0, numSamps);
-    IRbuffer.applyGain(0, numSamps, 1/mag);
+    auto numSamples = buffer.getNumSamples();
+    auto numChannels = std::min(2, buffer.getNumChannels());
+    auto parameters = offlineEngine->getWindowParameters();
+    
+    //The realtime pair carries on from silence, like the offline pair prepared for the render
+    if(isOfflineStartPending)
+    {
+        convEngine->reset();
+        convEngineR->reset();
+        isOfflineStartPending = false;
+    }
+    
+    //Each host block is swapped with the output of the last full partition, so the output runs offlinePartitionSize behind
+    for(auto position = 0; position < numSamples;)
+    {
+        auto numToCopy = std::min(numSamples - position, offlinePartitionSize - offlineFifoPosition);
+        
+        if(!(parameters == offlineChanges.back().parameters))
+        {
+            if(offlineChanges.back().position == offlineFifoPosition)
+                offlineChanges.back().parameters = parameters;
+            else
+                offlineChanges.push_back({offlineFifoPosition, parameters});
+        }
+        
+        for(auto ch = 0; ch < numChannels; ++ch)
+        {
+            juce::FloatVectorOperations::copy(offlineInput[ch].data() + offlineFifoPosition, buffer.getReadPointer(ch, position), numToCopy);
+            juce::FloatVectorOperations::copy(buffer.getWritePointer(ch, position), offlineOutput[ch].data() + offlineFifoPosition, numToCopy);
+        }
+        
+        position += numToCopy;
+        offlineFifoPosition += numToCopy;
+        
+        if(offlineFifoPosition < offlinePartitionSize)
+            continue;
+        
+        auto stereo = numChannels > 1 && needsStereoProcessing();
+        
+        if(stereo && !wasOfflineStereo)
+        {
+            offlineEngineR->reset();
+            convEngineR->reset();
+        }
+        
+        wasOfflineStereo = stereo;
+        
+        //The large partitions only play stretches where the window held still since the partition before, where their
+        //output is the same as playback's, as long as the realtime pair is on the same grid
+        //Anywhere else the realtime pair plays the partition, moving the window on every block as playback does
+        auto& lastParameters = offlineChanges.back().parameters;
+        auto isSteady = std::all_of(offlineChanges.begin(), offlineChanges.end(), [&](const ParameterChange& change)
+        {
+            return isSameWindow(change.parameters, lastParameters);
+        });
+        
+        auto playLarge = (isSteady && wasOfflineWindowSteady && isSameWindow(lastParameters, lastOfflineWindow))
+                      || engineBlockSize != preparedBlockSize;
+        
+        wasOfflineWindowSteady = isSteady;
+        lastOfflineWindow = lastParameters;
+        
+        auto* playing = playLarge ? offlineEngine.get() : convEngine.get();
+        auto* playingR = playLarge ? offlineEngineR.get() : convEngineR.get();
+        auto* listening = playLarge ? convEngine.get() : offlineEngine.get();
+        auto* listeningR = playLarge ? convEngineR.get() : offlineEngineR.get();
+        
+        //The other pair only takes the input in, so it can take over from any partition
+        listening->feedHistory(offlineInput[0], lastParameters);
+        
+        if(stereo)
+            listeningR->feedHistory(offlineInput[1], lastParameters);
+        
+        for(size_t i = 0; i < offlineChanges.size(); ++i)
+        {
+            auto start = static_cast<size_t>(offlineChanges[i].position);
+            auto end = i + 1 < offlineChanges.size() ? static_cast<size_t>(offlineChanges[i + 1].position) : offlineInput[0].size();
+            auto& segmentParameters = offlineChanges[i].parameters;
+            
+            playing->process(std::span<float>(offlineInput[0]).subspan(start, end - start), segmentParameters);
+            
+            if(stereo)
+                playingR->process(std::span<float>(offlineInput[1]).subspan(start, end - start), segmentParameters);
+        }
+        
+        if(numChannels > 1 && !stereo)
+            offlineInput[1] = offlineInput[0];
+        
+        for(auto ch = 0; ch < numChannels; ++ch)
+            std::swap(offlineInput[ch], offlineOutput[ch]);
+        
+        //The block still being copied carries on with its parameters in the next partition
+        offlineChanges.erase(offlineChanges.begin(), offlineChanges.end() - 1);
+        offlineChanges.front().position = 0;
+        offlineFifoPosition = 0;
+    }
 }
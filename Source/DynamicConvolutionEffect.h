@@ -10,12 +10,19 @@
 
 #pragma once
 
+#include "DSPScheduler.h"
 #include "DynamicConvolver.h"
+#include "IRFileLoader.h"
+#include "MemoryBudget.h"
+#include "SpectrumShaper.h"
 
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_core/juce_core.h>
 #include <juce_audio_formats/juce_audio_formats.h>
+#include <juce_events/juce_events.h>
 
+#include <algorithm>
+#include <array>
 #include <vector>
 #include <span>
 
@@ -24,28 +31,165 @@
 //Wrapper Class for Dynamic Convolvutoin class
 // Handles JUCE terminology, and IR stereo handling
 
-class DynamicConvolutionEffect
+//Listeners are told on the message thread when what a slot plays may have changed
+class DynamicConvolutionEffect : public juce::ChangeBroadcaster,
+                                  private juce::ChangeListener,
+                                  private juce::AsyncUpdater
 {
 public:
     
     DynamicConvolutionEffect(juce::AudioProcessorValueTreeState& vts);
+    ~DynamicConvolutionEffect() override;
     
-    void prepare(int buffsize);
-    void loadFileAsIR(juce::File newFile);
-    void processBlock(juce::AudioBuffer<float> buffer);
+    //Every parameter the effect and its engines read, for the plugin's value tree state
+    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
     
+    //nonRealtime is the host's isNonRealtime(), offline renders use large partitions for throughput
+    //A new block size is partitioned in the background, the engines keep playing their old partitions until it's ready
+    void prepare(double sampleRate, int buffsize, bool nonRealtime = false);
+    void loadFileAsIR(juce::File newFile, int slot);
     
+    //Built into the engines on the rebuilder thread, the slot plays it from then on, and getSlotIR() and the change
+    //broadcast follow on the message thread
+    //A slot that is being captured keeps the capture, the IR is loaded once the capture has been committed
+    void loadIR(std::shared_ptr<const LoadedIR> newIR, int slot);
+    void processBlock(juce::AudioBuffer<float> buffer, juce::AudioBuffer<float> sidechain);
+    
+    //Call from the host's setNonRealtime(), which JUCE doesn't keep off the audio thread
+    //Going offline prepares the offline engines and copies the IRs, so it allocates and waits for loads, which only
+    //a render that isn't realtime would hear, going back to realtime just switches
+    //Blocks keep going through whichever engines were switched to last
+    void setNonRealtime(bool nonRealtime);
+    
+    //Only non-zero while rendering offline, the host compensates it
+    int getLatencySamples() const;
+    
+    //Partition size of the offline engines, latency doesn't matter there so it's picked for throughput
+    static constexpr int offlinePartitionSize = 8192;
+    
+    //What slot plays, a decoded file or a committed capture, with its waveform peaks, message thread only
+    std::shared_ptr<const LoadedIR> getSlotIR(int slot) const { return currentIRs[slot]; }
+    
+    //Bytes held by this instance's engines, the budget counts those of every instance in the process
+    size_t getMemoryBytes() const;
+    
+    //Samples cut off the end of the IR in slot, when it's longer than the engines playing hold, 0 when all of it plays
+    int getNumDroppedSamples(int slot) const;
+    const MemoryBudget& getMemoryBudget() const { return memoryBudget.getObject(); }
     
 private:
-    void normalizeFile();
+    void changeListenerCallback(juce::ChangeBroadcaster* source) override;
+    void handleAsyncUpdate() override;
+    
+    bool needsStereoProcessing() const;
+    
+    //Same window and slots, whatever the mix
+    static bool isSameWindow(DynamicConvolverV2::WindowParameters a, const DynamicConvolverV2::WindowParameters& b);
+    int getSlotParameter(const std::atomic<float>* parameter) const;
+    
+    //Records the sidechain into slot A while CAPTURE is on, audio thread only
+    void updateCapture(const juce::AudioBuffer<float>& sidechain);
+    
+    //Switching to offline prepares the offline engines before they're used
+    //Switching back leaves the realtime engines' stale history for the audio thread to clear on its next block
+    void setOfflineMode(bool shouldBeOffline);
+    void processOffline(juce::AudioBuffer<float>& buffer);
+    
+    //Loads waiting for the rebuilder thread, which builds them into every engine that needs them, false if there were none
+    bool buildQueuedLoads();
+    void buildLoad(std::shared_ptr<const LoadedIR> newIR, int slot);
+    
+    //The spare pair is partitioned for a new block size on the rebuilder thread, false if there was nothing to do yet
+    //The audio thread swaps it in, and the pair it replaced plays out its tail fed with silence, which sums
+    //to the same output as if nothing had changed, before it's released on the message thread
+    class Rebuilder;
+    bool buildSpareEngines();
+    void swapInSpareEngines();
+    void ringOutSpareEngines(juce::AudioBuffer<float>& buffer, const DynamicConvolverV2::WindowParameters& parameters, bool stereo);
+    void releaseSpareEngines();
+    
+    //The committed capture of slot, in the same form as a decoded file, so the editor can draw it
+    std::shared_ptr<const LoadedIR> createCapturedIR(int slot) const;
     
-    juce::AudioFormatManager formatManager;
+    IRFileLoader irLoader {DynamicConvolverV2::numSlots};
     
-    std::vector<float> IRdata;
-    juce::AudioBuffer<float>IRbuffer;
+    //One worker pool and memory budget for every instance in the process, declared before the engines so they outlive them
+    juce::SharedResourcePointer<DSPScheduler> scheduler;
+    juce::SharedResourcePointer<MemoryBudget> memoryBudget;
+    
+    //What each slot plays, and the last IR taken from the loader, message thread only
+    std::array<std::shared_ptr<const LoadedIR>, DynamicConvolverV2::numSlots> currentIRs;
+    std::array<std::shared_ptr<const LoadedIR>, DynamicConvolverV2::numSlots> decodedIRs;
+    
+    //Loads waiting for the rebuilder, built ones waiting to be handed over, and ones waiting for a capture to be committed
+    //Pending ones are only changed under engineLock too, so a commit can't miss one the rebuilder was just refused
+    juce::CriticalSection loadLock;
+    std::array<std::shared_ptr<const LoadedIR>, DynamicConvolverV2::numSlots> queuedIRs;
+    std::array<std::shared_ptr<const LoadedIR>, DynamicConvolverV2::numSlots> builtIRs;
+    std::array<std::shared_ptr<const LoadedIR>, DynamicConvolverV2::numSlots> pendingIRs;
     
     std::unique_ptr<DynamicConvolverV2> convEngine;
     std::unique_ptr<DynamicConvolverV2> convEngineR;
     
-    bool isIrStereo = false;
+    //Second realtime pair, swapped with the one above when the block size changes
+    std::unique_ptr<DynamicConvolverV2> spareEngine;
+    std::unique_ptr<DynamicConvolverV2> spareEngineR;
+    
+    enum class SpareState { idle, building, ready, ringing, retired };
+    std::atomic<SpareState> spareState {SpareState::idle};
+    std::atomic<int> requestedBlockSize {0}; //0 for none
+    int engineBlockSize = 0;
+    int spareBlockSize = 0;
+    int ringOutRemaining = 0;
+    std::array<std::vector<float>, 2> ringOutBuffers;
+    
+    //Guards which pair is playing, taken by the rebuilder and the message thread, the audio thread only ever tries it
+    juce::CriticalSection engineLock;
+    std::unique_ptr<Rebuilder> rebuilder;
+    
+    //Offline rendering, the host blocks go through a FIFO of offlinePartitionSize
+    //The realtime pair plays the partitions where the window moved, each pair takes in the input the other plays
+    std::unique_ptr<DynamicConvolverV2> offlineEngine;
+    std::unique_ptr<DynamicConvolverV2> offlineEngineR;
+    std::array<std::vector<float>, 2> offlineInput;
+    std::array<std::vector<float>, 2> offlineOutput;
+    int offlineFifoPosition = 0;
+    
+    //Parameters of each host block, from the position in the FIFO where it started
+    //The partition is processed in segments between them, so automation lands where it did during playback
+    struct ParameterChange
+    {
+        int position;
+        DynamicConvolverV2::WindowParameters parameters;
+    };
+    
+    std::vector<ParameterChange> offlineChanges;
+    
+    //Whether the window held still through the last partition, and where it ended, audio thread only
+    bool wasOfflineWindowSteady = false;
+    DynamicConvolverV2::WindowParameters lastOfflineWindow;
+    bool isOfflineStartPending = false; //Written before isOffline is set, read once it is
+    int preparedBlockSize = 0;
+    double preparedSampleRate = 0.0;
+    std::atomic<bool> isOffline {false};
+    std::atomic<bool> isRealtimeResetPending {false};
+    
+    //Rebuilds the shaped IR spectra of all four engines, stopped before they go away
+    SpectrumShaper shaper;
+    
+    std::array<std::atomic<bool>, DynamicConvolverV2::numSlots> isIrStereo {};
+    
+    //Whether the right engines were fed on their last block, audio thread only
+    bool wasStereo = false;
+    bool wasOfflineStereo = false;
+    
+    std::atomic<float>* slotAParameter = nullptr;
+    std::atomic<float>* slotBParameter = nullptr;
+    std::atomic<float>* morphParameter = nullptr;
+    std::atomic<float>* captureParameter = nullptr;
+    
+    //Written by the audio thread, prepare() reads it on the message thread
+    std::atomic<bool> isCapturing {false};
+    int capturingSlot = 0; //Written before isCommitPending is set, read once it is
+    std::atomic<bool> isCommitPending {false};
 };
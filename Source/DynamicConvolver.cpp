@@ -9,84 +9,1253 @@
 */
 
 #include "DynamicConvolver.h"
+#include "SpectrumShaper.h"
+#include "Trace.h"
 
 
 
-DynamicConvolverV2::DynamicConvolverV2(juce::AudioProcessorValueTreeState& vts) : valueTreeState(vts)
+DynamicConvolverV2::DynamicConvolverV2(juce::AudioProcessorValueTreeState& vts) : valueTreeState(&vts)
 {
-    valueTreeState.addParameterListener("FILE_POS", this);
-    valueTreeState.addParameterListener("FILE_LEN", this);
-    valueTreeState.addParameterListener("DRY_WET", this);
+    valueTreeState->addParameterListener("FILE_POS", this);
+    valueTreeState->addParameterListener("FILE_LEN", this);
+    valueTreeState->addParameterListener("DRY_WET", this);
+    valueTreeState->addParameterListener("SLOT_A", this);
+    valueTreeState->addParameterListener("SLOT_B", this);
+    valueTreeState->addParameterListener("MORPH", this);
+    valueTreeState->addParameterListener("REVERSE", this);
+    valueTreeState->addParameterListener("LOW_CUT", this);
+    valueTreeState->addParameterListener("HIGH_CUT", this);
+    valueTreeState->addParameterListener("TILT", this);
+    valueTreeState->addParameterListener("DAMPING", this);
 }
 
-void DynamicConvolverV2::prepare(int blockSize)
+DynamicConvolverV2::DynamicConvolverV2()
 {
+}
+
+DynamicConvolverV2::~DynamicConvolverV2()
+{
+    //Hands this engine's share back to the budget
+    setMemoryBudget(nullptr);
+}
+
+void DynamicConvolverV2::setParameters(float newFilePos, float newFileLen, float newDryWet)
+{
+    filePosition.store(newFilePos);
+    fileLength.store(newFileLen);
+    dryWet.store(newDryWet);
+}
+
+void DynamicConvolverV2::setMorph(int newSlotA, int newSlotB, float newMorph)
+{
+    slotA.store(juce::jlimit(0, numSlots - 1, newSlotA));
+    slotB.store(juce::jlimit(0, numSlots - 1, newSlotB));
+    morph.store(newMorph);
+}
+
+void DynamicConvolverV2::setReverse(bool shouldReverse)
+{
+    reverse.store(shouldReverse);
+}
+
+void DynamicConvolverV2::setShaping(float newLowCutHz, float newHighCutHz, float newTiltDb, float newDamping)
+{
+    lowCut.store(newLowCutHz);
+    highCut.store(newHighCutHz);
+    tilt.store(newTiltDb);
+    damping.store(newDamping);
+    requestShapingUpdate();
+}
+
+void DynamicConvolverV2::setSampleRate(double newSampleRate)
+{
+    const juce::ScopedLock sl(shapingLock);
+    sampleRate = newSampleRate;
+    requestShapingUpdate();
+}
+
+void DynamicConvolverV2::setShaper(SpectrumShaper* newShaper)
+{
+    shaper.store(newShaper);
+}
+
+void DynamicConvolverV2::setSpectrumStorage(SpectrumStorage newStorage)
+{
+    preferredStorage = newStorage;
+}
+
+size_t DynamicConvolverV2::getSpectrumMemoryBytes() const
+{
+    size_t bytes = 0;
+    
+    for(auto* pool : {&sourcePool, &shapedPools[0], &shapedPools[1]})
+        for(auto stored = 0; stored < numStoredSlots; ++stored)
+            bytes += pool->spectra[stored].size() * sizeof(float)
+                   + pool->compact[stored].size() * sizeof(juce::int16)
+                   + pool->scales[stored].size() * sizeof(float);
+    
+    return bytes;
+}
+
+void DynamicConvolverV2::setMaxWindowLength(int numSamples)
+{
+    requestedWindowLength = std::max(0, numSamples);
+}
+
+void DynamicConvolverV2::setMemoryBudget(MemoryBudget* newBudget)
+{
+    auto bytes = bufferBytes.load() + irDataBytes.load();
+    
+    if(memoryBudget != nullptr)
+        memoryBudget->resize(bytes, 0);
+    
+    memoryBudget = newBudget;
+    
+    if(memoryBudget != nullptr)
+        memoryBudget->resize(0, bytes);
+}
+
+size_t DynamicConvolverV2::getMemoryBytes() const
+{
+    return bufferBytes.load() + irDataBytes.load();
+}
+
+size_t DynamicConvolverV2::getPlannedBytes(SpectrumStorage plannedStorage, int capacity, int historyLength) const
+{
+    //Every stored slot's edges, and the spare reserved for captures, the IRs are counted as they're loaded
+    auto numPartitions = (size_t) numStoredSlots * numEdgePartitions + (size_t) (windowGrid == 0 ? capacity : 0);
+    auto poolBytes = plannedStorage == SpectrumStorage::compact
+                   ? numPartitions * numCompactBlocks * (compactBlockSize * sizeof(juce::int16) + sizeof(float))
+                   : numPartitions * spectrumSize * sizeof(float);
+    
+    //Has to follow what prepare() allocates, scratch and overlap buffers included
+    auto scratchValues = (size_t) fftSize * 2 * 5 + (size_t) fftSize + (size_t) spectrumSize + (size_t) bufferSize * 2
+                       + (size_t) getShapingScratchSize() * 2;
+    auto numSpectra = (size_t) historyLength + (scheduler != nullptr ? (size_t) maxChunks : 0);
+    
+    //Only the source pool, the shaped ones are allocated and counted once shaping is used
+    return poolBytes
+         + numSpectra * (spectrumSize * sizeof(float) + sizeof(std::vector<float>))
+         + (size_t) capacity * bufferSize * sizeof(float)
+         + scratchValues * sizeof(float);
+}
+
+int DynamicConvolverV2::getNumDroppedSamples(int slot) const
+{
+    return slots[storedSlots[slot].load()].numDroppedSamples.load();
+}
+
+int DynamicConvolverV2::getHistoryLength(int capacity, int maxWindowLength) const
+{
+    if(maxWindowLength == 0)
+        return capacity;
+    
+    //A window cut to the sample can start anywhere in its first partition, and a grid window anywhere in its first grid unit
+    return std::min(capacity, (maxWindowLength + windowGrid + bufferSize - 1) / bufferSize + 1);
+}
+
+namespace
+{
+    template <typename T>
+    size_t getAllocatedBytes(const std::vector<T>& data)
+    {
+        return data.capacity() * sizeof(T);
+    }
+    
+    template <typename T>
+    size_t getAllocatedBytes(const std::vector<std::vector<T>>& matrix)
+    {
+        auto bytes = matrix.capacity() * sizeof(std::vector<T>);
+        for(auto& inner : matrix)
+            bytes += getAllocatedBytes(inner);
+        
+        return bytes;
+    }
+}
+
+size_t DynamicConvolverV2::countBufferBytes() const
+{
+    size_t bytes = 0;
+    
+    for(auto* pool : {&sourcePool, &shapedPools[0], &shapedPools[1]})
+    {
+        for(auto stored = 0; stored < numStoredSlots; ++stored)
+            bytes += getAllocatedBytes(pool->spectra[stored]) + getAllocatedBytes(pool->compact[stored])
+                   + getAllocatedBytes(pool->scales[stored]);
+        
+        bytes += getAllocatedBytes(pool->binGains) + getAllocatedBytes(pool->dampingRates);
+    }
+    
+    for(auto* buffer : {&fftBuffer, &irScratch, &windowedFFT, &reversePhase, &overlapBuffer, &blockInput,
+                        &historyOutput, &edgeScratch, &captureBuffer, &captureScratch, &shapingScratch,
+                        &liveShapingScratch})
+        bytes += getAllocatedBytes(*buffer);
+    
+    return bytes + getAllocatedBytes(inputFFTbuffer) + getAllocatedBytes(partialSums);
+}
+
+size_t DynamicConvolverV2::countIRDataBytes() const
+{
+    size_t bytes = 0;
+    for(auto& data : irData)
+        bytes += getAllocatedBytes(data);
+    
+    return bytes;
+}
+
+void DynamicConvolverV2::account(std::atomic<size_t>& share, size_t bytes)
+{
+    auto previous = share.exchange(bytes);
+    
+    if(memoryBudget != nullptr)
+        memoryBudget->resize(previous, bytes);
+}
+
+void DynamicConvolverV2::setWindowGrid(int gridSize)
+{
+    windowGrid = std::max(0, gridSize);
+    gridWindows = {};
+}
+
+void DynamicConvolverV2::setScheduler(DSPScheduler* newScheduler)
+{
+    scheduler = newScheduler;
+}
+
+void DynamicConvolverV2::prepare(int blockSize, int partitionCapacity)
+{
+    //Loads build into the pools this replaces, so they wait
+    const juce::ScopedLock dataLock(irDataLock);
+    const juce::ScopedLock sl(shapingLock);
+    
     bufferSize = blockSize;
     fftSize = bufferSize * 2;
+    spectrumSize = fftSize + 2;
+    numCompactBlocks = (spectrumSize + compactBlockSize - 1) / compactBlockSize;
+    
+    //Whatever doesn't fit the budget falls back to compact spectra, then a shorter window, then fewer partitions
+    //The smallest layout is prepared regardless, it goes over the budget rather than not play
+    auto capacity = juce::jlimit(1, maxPartitions, partitionCapacity);
+    auto plannedStorage = preferredStorage;
+    auto plannedWindow = requestedWindowLength;
+    auto currentBytes = bufferBytes.load();
+    
+    for(;;)
+    {
+        auto plannedBytes = getPlannedBytes(plannedStorage, capacity, getHistoryLength(capacity, plannedWindow));
+        auto fits = memoryBudget == nullptr || memoryBudget->tryResize(currentBytes, plannedBytes);
+        
+        if(!fits && plannedStorage == SpectrumStorage::compact && capacity == 1)
+        {
+            memoryBudget->resize(currentBytes, plannedBytes);
+            fits = true;
+        }
+        
+        if(fits)
+        {
+            //The real count replaces the plan once it's all allocated
+            bufferBytes.store(plannedBytes);
+            break;
+        }
+        
+        if(plannedStorage == SpectrumStorage::full)
+            plannedStorage = SpectrumStorage::compact;
+        else if(getHistoryLength(capacity, plannedWindow) > 2)
+            plannedWindow = std::max(1, (plannedWindow > 0 ? plannedWindow : capacity * bufferSize) / 2);
+        else
+            capacity = (capacity + 1) / 2;
+    }
+    
+    storage = plannedStorage;
+    windowLimit = plannedWindow;
+    partitionsPerSlot = capacity;
+    
+    fftOrder = std::log2(fftSize);
+    fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+    
+    //Resize Arrays
+    fftBuffer.resize(fftSize * 2); //Ensure FFTbuffers are 2x fftSize
+    irScratch.resize(fftSize * 2);
+    windowedFFT.resize(fftSize * 2);
+    
+    //Reversing a partition of bufferSize samples in place is a conjugation plus a delay of bufferSize - 1
+    reversePhase.resize(spectrumSize);
+    for(auto bin = 0; bin < spectrumSize / 2; ++bin)
+    {
+        auto angle = -juce::MathConstants<double>::twoPi * bin * (bufferSize - 1) / fftSize;
+        reversePhase[bin * 2] = static_cast<float>(std::cos(angle));
+        reversePhase[bin * 2 + 1] = static_cast<float>(std::sin(angle));
+    }
+    overlapBuffer.resize(bufferSize);
+    blockInput.resize(bufferSize);
+    historyOutput.resize(fftSize);
+    edgeScratch.resize(fftSize * 2);
+    windowEdges = {};
+    for(auto& edges : activeEdges)
+        edges = {-1, -1};
+    
+    //Captured samples survive a block size change, the partitions are rebuilt from them
+    captureScratch.resize(fftSize * 2);
+    captureBuffer.resize((size_t) partitionsPerSlot * bufferSize, 0.0f);
+    captureLength = std::min(captureLength, static_cast<int>(captureBuffer.size()));
+    
+    //Stored slots start with room for their edges only, each is sized to the IR loaded into it
+    //The shaped pools are only allocated once the shaping is first used
+    sourcePool = {};
+    allocatePool(sourcePool);
+    shapedPools = {};
+    spareUse.store(SpareUse::none);
+    isSpareReserved.store(false);
+    shapedCapturePartitions.store(0);
+    activePool.store(&sourcePool);
+    blockPool = &sourcePool;
+    shapingScratch.resize((size_t) getShapingScratchSize());
+    liveShapingScratch.resize((size_t) getShapingScratchSize());
+    requestShapingUpdate();
+    
+    //Only as much history as the longest window can reach, which is the whole slot unless it's limited
+    inputFFTbuffer = {};
+    partialSums = {};
+    resizeMatrix(inputFFTbuffer, (size_t) getHistoryLength(partitionsPerSlot, windowLimit), (size_t) spectrumSize);
+    resizeMatrix(partialSums, scheduler != nullptr ? (size_t) maxChunks : 0, (size_t) spectrumSize);
+    inputFftIndex = 0;
+    
+    //Nothing is kept from a larger block size, so the count comes out as planned
+    for(auto* buffer : {&fftBuffer, &irScratch, &windowedFFT, &reversePhase, &overlapBuffer, &blockInput,
+                        &historyOutput, &edgeScratch, &captureBuffer, &captureScratch, &shapingScratch,
+                        &liveShapingScratch})
+        buffer->shrink_to_fit();
+    
+    account(bufferBytes, countBufferBytes());
+    
+    clearBuffers();
+    
+    //Re-partition every loaded IR for the new block size, a capture still running carries on from its samples
+    storeCapturedIR();
+    
+    gridWindows = {};
+    
+    for(auto& slot : slots)
+        slot.numPartitions.store(0);
+    
+    for(auto slot = 0; slot < numSlots; ++slot)
+    {
+        //Grid windows are cut on the first block, in place
+        if(windowGrid > 0)
+        {
+            resizeStoredSlot(storedSlots[slot].load(), getGridCapacity(static_cast<int>(irData[slot].size())));
+            storeGridDroppedSamples(slot, storedSlots[slot].load());
+        }
+        else if(slot == captureSlot.load())
+        {
+            resizeStoredSlot(storedSlots[slot].load(), partitionsPerSlot);
+            
+            //A partly filled partition is left to the next blocks, or endCapture()
+            for(auto partition = 0; partition < captureLength / bufferSize; ++partition)
+                transformCapturedPartition(partition);
+        }
+        else if(!irData[slot].empty())
+            createIRfft(slot, claimSpareSlot());
+    }
+    
+    //Sized for captures even if nothing was loaded
+    claimSpareSlot();
+    releaseSpareSlot();
+}
+
+
+
+void DynamicConvolverV2::reset()
+{
+    clearBuffers();
+}
+
+void DynamicConvolverV2::release()
+{
+    const juce::ScopedLock dataLock(irDataLock);
+    const juce::ScopedLock sl(shapingLock);
+    
+    //Loads until the next prepare() only keep their samples, process() passes the input through
+    bufferSize = 0;
+    
+    for(auto& slot : slots)
+        slot.numPartitions.store(0);
+    
+    activePool.store(&sourcePool);
+    blockPool = &sourcePool;
+    waitForPoolUsers();
+    
+    sourcePool = {};
+    shapedPools = {};
+    isSpareReserved.store(false);
+    std::vector<std::vector<float>>().swap(inputFFTbuffer);
+    std::vector<std::vector<float>>().swap(partialSums);
+    std::vector<float>().swap(captureBuffer);
+    captureLength = 0;
+    
+    gridWindows = {};
+    windowEdges = {};
+    account(bufferBytes, countBufferBytes());
+}
+
+int DynamicConvolverV2::getTailLength() const
+{
+    auto numPartitions = 0;
+    for(auto& stored : storedSlots)
+        numPartitions = std::max(numPartitions, slots[stored.load()].numPartitions.load());
+    
+    //The window can't be longer than its slot, plus the block still in the overlap
+    return (numPartitions + 1) * bufferSize;
+}
+
+void DynamicConvolverV2::copyIRsFrom(const DynamicConvolverV2& other)
+{
+    const juce::ScopedLock otherLock(other.irDataLock);
+    const juce::ScopedLock sl(irDataLock);
+    
+    for(auto slot = 0; slot < numSlots; ++slot)
+    {
+        irData[slot] = other.irData[slot];
+        ++irVersions[slot];
+        
+        if(bufferSize == 0)
+            continue;
+        
+        if(windowGrid > 0)
+            createGridSlot(slot, claimSpareSlot());
+        else if(irData[slot].empty())
+            slots[storedSlots[slot].load()].numPartitions.store(0);
+        else
+            createIRfft(slot, claimSpareSlot());
+    }
+
+    account(irDataBytes, countIRDataBytes());
+}
+
+bool DynamicConvolverV2::loadNewIR(std::span<const float> newData, int slot)
+{
+    if (newData.empty() || !juce::isPositiveAndBelow(slot, numSlots))
+        return false;
+    
+    const juce::ScopedLock sl(irDataLock);
+    
+    //Claimed before the check, a capture can't start on the slot from here until the load is swapped in
+    //prepare() partitions it if nothing is prepared yet
+    auto spare = bufferSize > 0 ? claimSpareSlot() : -1;
+    
+    //commitCapture() would overwrite the load's samples with the capture's, under spectra built from the load
+    if(slot == captureSlot.load() || (captureCommitPending.load() && slot == capturedSlot))
+    {
+        if(spare >= 0)
+        {
+            const juce::ScopedLock shaping(shapingLock);
+            releaseSpareSlot();
+        }
+        
+        return false;
+    }
+    
+    irData[slot].assign(newData.begin(), newData.end());
+    irData[slot].shrink_to_fit();
+    ++irVersions[slot];
+    account(irDataBytes, countIRDataBytes());
+    
+    if(spare >= 0 && windowGrid > 0)
+        createGridSlot(slot, spare);
+    else if(spare >= 0)
+        createIRfft(slot, spare);
+    
+    return true;
+}
+
+std::vector<float> DynamicConvolverV2::getIRData(int slot) const
+{
+    const juce::ScopedLock sl(irDataLock);
+    return irData[slot];
+}
+
+float* DynamicConvolverV2::getSlotPartition(SpectrumPool& pool, int slot, int partition)
+{
+    return pool.spectra[slot].data() + getStoredIndex(partition) * spectrumSize;
+}
+
+void DynamicConvolverV2::allocatePool(SpectrumPool& pool)
+{
+    for(auto stored = 0; stored < numStoredSlots; ++stored)
+        allocateSlot(pool, stored, &pool == &sourcePool ? 0 : sourcePool.capacities[stored]);
+    
+    pool.isAllocated = true;
+}
+
+void DynamicConvolverV2::allocateSlot(SpectrumPool& pool, int slot, int numPartitions)
+{
+    auto numStored = (size_t) (numPartitions + numEdgePartitions);
+    auto isCompact = storage == SpectrumStorage::compact;
+    auto numFloats = isCompact ? 0 : numStored * spectrumSize;
+    auto numValues = isCompact ? numStored * numCompactBlocks * compactBlockSize : 0;
+    auto numScales = isCompact ? numStored * numCompactBlocks : 0;
+    
+    //Swapped for a new allocation rather than resized, so a slot that shrinks hands its memory back
+    if(pool.spectra[slot].size() != numFloats)
+        std::vector<float>(numFloats, 0.0f).swap(pool.spectra[slot]);
+    
+    if(pool.compact[slot].size() != numValues)
+        std::vector<juce::int16>(numValues, 0).swap(pool.compact[slot]);
+    
+    if(pool.scales[slot].size() != numScales)
+        std::vector<float>(numScales, 0.0f).swap(pool.scales[slot]);
+    
+    pool.capacities[slot] = numPartitions;
+}
+
+void DynamicConvolverV2::resizeStoredSlot(int slot, int numPartitions)
+{
+    for(auto* pool : {&sourcePool, &shapedPools[0], &shapedPools[1]})
+        if(pool->isAllocated)
+            allocateSlot(*pool, slot, numPartitions);
+}
+
+void DynamicConvolverV2::storePartition(int slot, int partition, float* spectrum)
+{
+    writePartition(sourcePool, slot, partition, spectrum);
+    ++sourceWrites;
+}
+
+void DynamicConvolverV2::readPartition(SpectrumPool& pool, int slot, int partition, float* spectrum)
+{
+    if(storage == SpectrumStorage::full)
+    {
+        juce::FloatVectorOperations::copy(spectrum, getSlotPartition(pool, slot, partition), spectrumSize);
+        return;
+    }
+    
+    for(auto block = 0; block < numCompactBlocks; ++block)
+        widenCompactBlock(pool, slot, partition, block, 1.0f, spectrum + block * compactBlockSize, false);
+}
+
+void DynamicConvolverV2::writePartition(SpectrumPool& pool, int slot, int partition, const float* spectrum)
+{
+    if(storage == SpectrumStorage::full)
+    {
+        juce::FloatVectorOperations::copy(getSlotPartition(pool, slot, partition), spectrum, spectrumSize);
+        return;
+    }
+    
+    //Every block of values is scaled to the full int16 range by its own peak
+    auto firstBlock = getStoredIndex(partition) * numCompactBlocks;
+    
+    for(auto block = 0; block < numCompactBlocks; ++block)
+    {
+        auto offset = block * compactBlockSize;
+        auto numValues = std::min(compactBlockSize, spectrumSize - offset);
+        auto* values = pool.compact[slot].data() + (firstBlock + block) * compactBlockSize;
+        
+        float peak = 0.0f;
+        for(auto i = 0; i < numValues; ++i)
+            peak = std::max(peak, std::abs(spectrum[offset + i]));
+        
+        auto scale = peak / 32767.0f;
+        pool.scales[slot][firstBlock + block] = scale;
+        
+        for(auto i = 0; i < compactBlockSize; ++i)
+            values[i] = (i < numValues && scale > 0.0f) ? static_cast<juce::int16>(std::lround(spectrum[offset + i] / scale)) : 0;
+    }
+}
+
+void DynamicConvolverV2::createIRfft(int slot, int stored)
+{
+    //Callers hold irDataLock, so only one load builds at a time, and no shaping pass swaps the pools under it
+    const juce::ScopedLock sl(shapingLock);
+    
+    //get number or partitions needed
+    //Partition size is 1/2 FFTsize,
+    int partitionSize = bufferSize;
+    auto& data = irData[slot];
+    int totalSamples = static_cast<int>(data.size());
+    
+    //Ensure that we get enough partitions to hold any number of samples, i.e. round up numPartitions
+    int numPartitions = (totalSamples + partitionSize - 1) / partitionSize;
+    numPartitions = std::min(partitionsPerSlot, numPartitions);
+    numPartitions = fitToBudget(numPartitions, sourcePool.capacities[storedSlots[slot].load()]);
+    
+    DYNCONV_TRACE_SCOPE("Spectrum build");
+    
+    //Built in the spare stored slot, sized to the IR, the slot keeps playing its old spectra until it's swapped
+    resizeStoredSlot(stored, numPartitions);
+    auto& irSlot = slots[stored];
+    irSlot.numPartitions.store(0);
+    irSlot.dampingOrigin.store(0);
+    irSlot.dampingDirection.store(1);
+    
+    juce::Logger::writeToLog("Num IR Partitions" + juce::String(numPartitions));
+    juce::Logger::writeToLog("IR Total Samples: " + juce::String(totalSamples));
+    
+    //Copy data from loaded IR and split into partitions
+    for(auto i = 0; i < numPartitions; ++i)
+    {
+        juce::FloatVectorOperations::clear(irScratch.data(), irScratch.size());
+        
+        auto start = i * partitionSize;
+        auto numToCopy = std::min(partitionSize, totalSamples - start);
+        juce::FloatVectorOperations::copy(irScratch.data(), data.data() + start, numToCopy);
+        
+        //perform fft on each partition, only the non-negative bins are kept
+        fft->performRealOnlyForwardTransform(irScratch.data(), true);
+        storePartition(stored, i, irScratch.data());
+    }
+    
+    auto numSamples = std::min(totalSamples, numPartitions * partitionSize);
+    irSlot.gain.store(static_cast<float>(gainReferenceSize) / static_cast<float>(std::max(1, numSamples)));
+    irSlot.numSamples.store(numSamples);
+    irSlot.numDroppedSamples.store(totalSamples - numSamples);
+    irSlot.numPartitions.store(numPartitions);
+    
+    //Shaped before it's played, the lock keeps the active pool from being swapped meanwhile
+    //From the samples where the source pool holds them exactly, compact spectra are shaped from what they store like a rebuild
+    auto* pool = activePool.load();
+    auto samples = storage == SpectrumStorage::full ? std::span<const float>(data).first((size_t) numSamples) : std::span<const float>();
+    if(pool != &sourcePool)
+        shapePartitions(*pool, stored, 0, numPartitions, numPartitions, shapingScratch.data(), samples);
+    
+    //Played from the next segment on, the stored slot it replaces is spare once no segment still reads it
+    auto replaced = storedSlots[slot].exchange(stored);
+    waitForPoolUsers();
+    
+    //A committed capture is played whole from here, nothing waits for its shaping any more
+    if(replaced == captureStored.load())
+    {
+        captureStored.store(-1);
+        for(auto& shapedPool : shapedPools)
+            shapedPool.numCaptureShaped = 0;
+    }
+    
+    releaseSpareSlot();
+    requestShapingUpdate();
+    
+    juce::Logger::writeToLog("IR FFT Created Successfully in DynamicConvolverV2!");
+}
+
+int DynamicConvolverV2::fitToBudget(int numPartitions, int replacedPartitions)
+{
+    if(memoryBudget == nullptr)
+        return numPartitions;
+    
+    //Every allocated pool holds the slot, and the one it replaces becomes the spare, reserved for captures as before
+    auto numPools = 0;
+    for(auto* pool : {&sourcePool, &shapedPools[0], &shapedPools[1]})
+        numPools += pool->isAllocated ? 1 : 0;
+    
+    auto partitionBytes = numPools * (storage == SpectrumStorage::compact
+                                      ? (size_t) numCompactBlocks * (compactBlockSize * sizeof(juce::int16) + sizeof(float))
+                                      : (size_t) spectrumSize * sizeof(float));
+    
+    //Held as part of this engine's share until the real count replaces it
+    while(numPartitions > replacedPartitions)
+    {
+        auto currentBytes = bufferBytes.load();
+        auto plannedBytes = currentBytes + (size_t) (numPartitions - replacedPartitions) * partitionBytes;
+        
+        if(memoryBudget->tryResize(currentBytes, plannedBytes))
+        {
+            bufferBytes.store(plannedBytes);
+            break;
+        }
+        
+        auto limit = memoryBudget->getLimit();
+        auto used = memoryBudget->getUsedBytes();
+        auto room = limit > used ? (int) ((limit - used) / partitionBytes) : 0;
+        numPartitions = std::max(replacedPartitions, std::min(numPartitions - 1, replacedPartitions + room));
+    }
+    
+    return numPartitions;
+}
+
+int DynamicConvolverV2::getSpareSlot() const
+{
+    for(auto stored = 0; stored < numStoredSlots; ++stored)
+    {
+        auto isMapped = false;
+        for(auto& mapped : storedSlots)
+            isMapped = isMapped || mapped.load() == stored;
+        
+        if(!isMapped)
+            return stored;
+    }
+    
+    //Every slot maps to a different stored slot, so one is always left over
+    jassertfalse;
+    return numSlots;
+}
+
+int DynamicConvolverV2::claimSpareSlot()
+{
+    //A capture only holds it while it swaps it in
+    for(auto expected = SpareUse::none; !spareUse.compare_exchange_weak(expected, SpareUse::load); expected = SpareUse::none)
+        juce::Thread::yield();
+    
+    isSpareReserved.store(false);
+    return getSpareSlot();
+}
+
+void DynamicConvolverV2::releaseSpareSlot()
+{
+    //Grid engines never capture, so their spare holds nothing
+    auto stored = getSpareSlot();
+    slots[stored].numPartitions.store(0);
+    resizeStoredSlot(stored, windowGrid == 0 ? partitionsPerSlot : 0);
+    account(bufferBytes, countBufferBytes());
+    
+    isSpareReserved.store(windowGrid == 0);
+    spareUse.store(SpareUse::none);
+}
+
+bool DynamicConvolverV2::beginCapture(int slot)
+{
+    //The last capture has to be handed over to irData before the buffer is reused
+    if(!juce::isPositiveAndBelow(slot, numSlots) || captureSlot.load() >= 0 || captureCommitPending.load())
+        return false;
+    
+    //Recorded into the spare, which has to be back at its full capacity, and not claimed by a load
+    auto expected = SpareUse::none;
+    if(!spareUse.compare_exchange_strong(expected, SpareUse::capture))
+        return false;
+    
+    if(!isSpareReserved.load())
+    {
+        spareUse.store(SpareUse::none);
+        return false;
+    }
+    
+    auto stored = getSpareSlot();
+    auto& irSlot = slots[stored];
+    irSlot.numPartitions.store(0);
+    irSlot.dampingOrigin.store(0);
+    irSlot.dampingDirection.store(1);
+    captureLength = 0;
+    captureSlot.store(slot);
+    shapedCapturePartitions.store(0);
+    captureStored.store(stored);
+    
+    //The slot goes quiet and grows from here, what it played is the spare now, and is replaced once the capture is committed
+    isSpareReserved.store(false);
+    storedSlots[slot].store(stored);
+    spareUse.store(SpareUse::none);
+    return true;
+}
+
+void DynamicConvolverV2::captureBlock(std::span<const float> input)
+{
+    if(captureSlot.load() < 0)
+        return;
+    
+    auto numToCopy = std::min(static_cast<int>(input.size()), static_cast<int>(captureBuffer.size()) - captureLength);
+    if(numToCopy <= 0)
+        return;
+    
+    auto firstPartition = captureLength / bufferSize;
+    juce::FloatVectorOperations::copy(captureBuffer.data() + captureLength, input.data(), numToCopy);
+    captureLength += numToCopy;
+    
+    //Only the partitions completed by this block are transformed, never the whole capture
+    for(auto partition = firstPartition; partition < captureLength / bufferSize; ++partition)
+        transformCapturedPartition(partition);
+}
+
+void DynamicConvolverV2::endCapture()
+{
+    if(captureSlot.load() < 0)
+        return;
+    
+    //Partly filled last partition, zero padded
+    if(bufferSize > 0 && captureLength % bufferSize != 0)
+        transformCapturedPartition(captureLength / bufferSize);
+    
+    capturedSlot = captureSlot.load();
+    captureCommitPending.store(true);
+    captureSlot.store(-1);
+}
+
+void DynamicConvolverV2::commitCapture()
+{
+    const juce::ScopedLock sl(irDataLock);
+    
+    //Partitioned again into a stored slot its size, the one it was recorded into is reserved for the next capture
+    if(storeCapturedIR() && windowGrid == 0 && bufferSize > 0)
+        createIRfft(capturedSlot, claimSpareSlot());
+}
+
+bool DynamicConvolverV2::storeCapturedIR()
+{
+    if(!captureCommitPending.load())
+        return false;
+    
+    //Kept as the slot's IR data, so prepare() can re-partition it like a loaded file
+    irData[capturedSlot].assign(captureBuffer.begin(), captureBuffer.begin() + captureLength);
+    irData[capturedSlot].shrink_to_fit();
+    ++irVersions[capturedSlot];
+    account(irDataBytes, countIRDataBytes());
+    captureCommitPending.store(false);
+    return true;
+}
+
+void DynamicConvolverV2::transformCapturedPartition(int partition)
+{
+    DYNCONV_TRACE_SCOPE("Capture partition");
+    
+    auto stored = storedSlots[captureSlot.load()].load();
+    auto start = partition * bufferSize;
+    auto numSamples = std::min(bufferSize, captureLength - start);
+    
+    juce::FloatVectorOperations::clear(captureScratch.data(), captureScratch.size());
+    juce::FloatVectorOperations::copy(captureScratch.data(), captureBuffer.data() + start, numSamples);
+    
+    fft->performRealOnlyForwardTransform(captureScratch.data(), true);
+    storePartition(stored, partition, captureScratch.data());
+    ++captureWrites;
+    
+    //Partition is complete before the MAC pass can see it, the window follows the capture as it grows
+    //Shaped spectra are left to updateShaping(), the shaped pool only plays as far as it has got
+    auto numPartitions = partition + 1;
+    auto capturedSamples = std::min(captureLength, numPartitions * bufferSize);
+    slots[stored].gain.store(static_cast<float>(gainReferenceSize) / static_cast<float>(capturedSamples));
+    slots[stored].numSamples.store(capturedSamples);
+    slots[stored].numDroppedSamples.store(0);
+    slots[stored].numPartitions.store(numPartitions);
+}
+
+void DynamicConvolverV2::createGridSlot(int slot, int stored)
+{
+    //Callers hold irDataLock, so the audio thread can't cut a window meanwhile
+    const juce::ScopedLock sl(shapingLock);
+    
+    resizeStoredSlot(stored, getGridCapacity(static_cast<int>(irData[slot].size())));
+    storeGridDroppedSamples(slot, stored);
+    
+    //The window playing now is cut from the new IR before the swap, so no block plays the slot empty
+    auto& current = gridWindows[slot];
+    if(current.start >= 0)
+        cutGridWindow(slot, stored, getGridWindow(slot, current.filePos, current.fileLen, current.reversed));
+    
+    storedSlots[slot].store(stored);
+    waitForPoolUsers();
+    releaseSpareSlot();
+}
+
+int DynamicConvolverV2::getGridCapacity(int totalSamples) const
+{
+    //Windows cover whole grid units of what the grid engine would hold
+    auto gridSamples = std::min(totalSamples, maxPartitions * windowGrid);
+    auto windowLength = (gridSamples + windowGrid - 1) / windowGrid * windowGrid;
+    return std::min(partitionsPerSlot, (windowLength + bufferSize - 1) / bufferSize);
+}
+
+void DynamicConvolverV2::storeGridDroppedSamples(int slot, int stored)
+{
+    //What the engine prepared with windowGrid would drop, and more should this engine's capacity be smaller
+    auto totalSamples = static_cast<int>(irData[slot].size());
+    auto gridSamples = std::min(totalSamples, maxPartitions * windowGrid);
+    slots[stored].numDroppedSamples.store(totalSamples - std::min(gridSamples, sourcePool.capacities[stored] * bufferSize));
+}
+
+DynamicConvolverV2::GridWindow DynamicConvolverV2::getGridWindow(int slot, float filePos, float fileLen, bool reversed) const
+{
+    auto totalSamples = static_cast<int>(irData[slot].size());
+    
+    //Same window as an engine prepared with windowGrid, on whole grid units with the edges cut to the sample
+    auto gridSamples = std::min(totalSamples, maxPartitions * windowGrid);
+    int cutStart = 0, cutEnd = 0;
+    getWindowRange(filePos, fileLen, gridSamples, windowLimit, cutStart, cutEnd);
+    
+    auto start = cutStart / windowGrid * windowGrid;
+    auto end = cutEnd > cutStart ? (cutEnd + windowGrid - 1) / windowGrid * windowGrid : start;
+    
+    return {start, end, cutStart, cutEnd, reversed, irVersions[slot].load(), filePos, fileLen};
+}
+
+void DynamicConvolverV2::updateGridWindow(int slot, float filePos, float fileLen, bool reversed)
+{
+    const juce::ScopedLock sl(irDataLock);
+    
+    auto newWindow = getGridWindow(slot, filePos, fileLen, reversed);
+    auto& current = gridWindows[slot];
+    
+    if(newWindow.start == current.start && newWindow.end == current.end
+       && newWindow.cutStart == current.cutStart && newWindow.cutEnd == current.cutEnd
+       && newWindow.reversed == current.reversed && newWindow.irVersion == current.irVersion)
+        return;
+    
+    //Shapes into the active pool, so it counts as a user while it does
+    const ScopedPoolUser user(poolUsers);
+    cutGridWindow(slot, storedSlots[slot].load(), newWindow);
+}
+
+void DynamicConvolverV2::cutGridWindow(int slot, int stored, const GridWindow& newWindow)
+{
+    DYNCONV_TRACE_SCOPE("Grid window build");
+    
+    auto& data = irData[slot];
+    auto totalSamples = static_cast<int>(data.size());
+    auto gridSamples = std::min(totalSamples, maxPartitions * windowGrid);
+    auto reversed = newWindow.reversed;
+    
+    gridWindows[slot] = newWindow;
+    slots[stored].dampingOrigin.store(reversed ? newWindow.end : newWindow.start);
+    slots[stored].dampingDirection.store(reversed ? -1 : 1);
+    
+    auto windowLength = newWindow.end - newWindow.start;
+    auto numPartitions = std::min(sourcePool.capacities[stored], (windowLength + bufferSize - 1) / bufferSize);
+    
+    //Reversed windows are cut backwards, so the MAC pass can run them forwards
+    auto getSample = [&](int i)
+    {
+        auto index = reversed ? newWindow.end - 1 - i : newWindow.start + i;
+        return index >= newWindow.cutStart && index < newWindow.cutEnd && index < totalSamples ? data[index] : 0.0f;
+    };
+    
+    for(auto partition = 0; partition < numPartitions; ++partition)
+    {
+        juce::FloatVectorOperations::clear(irScratch.data(), irScratch.size());
+        
+        auto first = partition * bufferSize;
+        auto numToCopy = std::min(bufferSize, windowLength - first);
+        for(auto i = 0; i < numToCopy; ++i)
+            irScratch[i] = getSample(first + i);
+        
+        fft->performRealOnlyForwardTransform(irScratch.data(), true);
+        storePartition(stored, partition, irScratch.data());
+    }
+    
+    auto* pool = activePool.load();
+    if(pool != &sourcePool)
+        shapePartitions(*pool, stored, 0, numPartitions, numPartitions, liveShapingScratch.data());
+    
+    //The whole of the cut out window is played
+    slots[stored].gain.store(static_cast<float>(gainReferenceSize) / static_cast<float>(std::max(1, gridSamples)));
+    slots[stored].numSamples.store(numPartitions * bufferSize);
+    slots[stored].numPartitions.store(numPartitions);
+    requestShapingUpdate();
+}
+
+void DynamicConvolverV2::getWindowRange(float filePos, float fileLen, int totalSamples, int maxLength, int& startSample, int& endSample)
+{
+    startSample = static_cast<int>(static_cast<double>(filePos) * totalSamples);
+    endSample = std::min(totalSamples, static_cast<int>(static_cast<double>(fileLen) * totalSamples) + startSample);
+    
+    if(maxLength > 0)
+        endSample = std::min(endSample, startSample + maxLength);
+}
+
+void DynamicConvolverV2::updateWindowEdges(int slot, int startSample, int endSample, bool firstPlayedOnly, bool reversed)
+{
+    auto& edges = activeEdges[slot];
+    edges = {-1, -1};
+    
+    if(endSample <= startSample)
+        return;
+    
+    auto first = startSample / bufferSize;
+    auto last = (endSample - 1) / bufferSize;
+    auto firstCut = startSample - first * bufferSize;
+    auto lastCut = endSample - last * bufferSize;
+    
+    //A window inside one partition has both of its edges in it
+    if(first == last)
+    {
+        if(firstCut > 0 || lastCut < bufferSize)
+        {
+            buildWindowEdge(slot, 0, first, firstCut, lastCut);
+            edges[0] = first;
+        }
+        
+        return;
+    }
+    
+    //Played reversed, the window starts from its last partition
+    if(firstCut > 0 && !(firstPlayedOnly && reversed))
+    {
+        buildWindowEdge(slot, 0, first, firstCut, bufferSize);
+        edges[0] = first;
+    }
+    
+    if(lastCut < bufferSize && !(firstPlayedOnly && !reversed))
+    {
+        buildWindowEdge(slot, 1, last, 0, lastCut);
+        edges[1] = last;
+    }
+}
+
+void DynamicConvolverV2::buildWindowEdge(int slot, int edge, int partition, int cutStart, int cutEnd)
+{
+    //Kept until the window moves, the slot is rewritten or a new shaping is swapped in
+    auto& cached = windowEdges[slot][edge];
+    WindowEdge key {partition, cutStart, cutEnd, blockPoolSwaps, sourceWrites.load()};
+    
+    if(key.partition == cached.partition && key.cutStart == cached.cutStart && key.cutEnd == cached.cutEnd
+       && key.poolSwaps == cached.poolSwaps && key.sourceWrites == cached.sourceWrites)
+        return;
+    
+    DYNCONV_TRACE_SCOPE("Window edge");
+    
+    cached = key;
+    
+    //Back to the partition's samples as they're played, shaped or not, cut, and transformed again
+    juce::FloatVectorOperations::clear(edgeScratch.data(), edgeScratch.size());
+    readPartition(*blockPool, slot, partition, edgeScratch.data());
+    fft->performRealOnlyInverseTransform(edgeScratch.data());
+    
+    juce::FloatVectorOperations::clear(edgeScratch.data(), cutStart);
+    juce::FloatVectorOperations::clear(edgeScratch.data() + cutEnd, edgeScratch.size() - cutEnd);
+    fft->performRealOnlyForwardTransform(edgeScratch.data(), true);
+    writePartition(*blockPool, slot, maxPartitions + edge, edgeScratch.data());
+}
+
+bool DynamicConvolverV2::isShapingFlat() const
+{
+    return lowCut.load() <= minLowCutHz && highCut.load() >= maxHighCutHz
+        && tilt.load() == 0.0f && damping.load() <= 0.0f;
+}
+
+void DynamicConvolverV2::requestShapingUpdate()
+{
+    ++shapingVersion;
+    
+    if(auto* currentShaper = shaper.load())
+        currentShaper->requestUpdate();
+}
+
+void DynamicConvolverV2::waitForPoolUsers() const
+{
+    //Anyone who starts after this sees the new pool, so it's enough to see no users once
+    while(poolUsers.load() > 0)
+        juce::Thread::yield();
+}
+
+void DynamicConvolverV2::computeShapingCurves(SpectrumPool& pool) const
+{
+    auto numBins = spectrumSize / 2;
+    pool.binGains.resize(numBins);
+    pool.dampingRates.resize(numBins);
+    
+    double lowCutHz = lowCut.load();
+    double highCutHz = highCut.load();
+    double tiltDb = tilt.load();
+    
+    pool.sampleRate = sampleRate;
+    pool.isDamped = damping.load() > 0.0f;
+    
+    auto nyquist = sampleRate * 0.5;
+    auto dampingPerSecond = -damping.load() * maxDampingDbPerSecond * std::log(10.0) / 20.0;
+    
+    for(auto bin = 0; bin < numBins; ++bin)
+    {
+        auto hz = bin * sampleRate / fftSize;
+        auto gain = 1.0;
+        
+        //Second order Butterworth magnitudes, without their phase
+        if(lowCutHz > minLowCutHz)
+            gain *= bin == 0 ? 0.0 : 1.0 / std::sqrt(1.0 + std::pow(lowCutHz / hz, 4.0));
+        
+        if(highCutHz < maxHighCutHz)
+            gain *= 1.0 / std::sqrt(1.0 + std::pow(hz / highCutHz, 4.0));
+        
+        if(tiltDb != 0.0)
+            gain *= std::pow(10.0, tiltDb * std::log2(std::max(hz, (double) minLowCutHz) / tiltPivotHz) / 20.0);
+        
+        pool.binGains[bin] = static_cast<float>(gain);
+        pool.dampingRates[bin] = static_cast<float>(dampingPerSecond * hz / nyquist);
+    }
+}
+
+void DynamicConvolverV2::designShapingFilter(const SpectrumPool& pool, int slot, int partition, float* filter)
+{
+    //Damping follows the time of the partition's centre in the IR
+    auto centre = slots[slot].dampingOrigin.load() + slots[slot].dampingDirection.load() * (partition * bufferSize + bufferSize / 2);
+    auto seconds = static_cast<float>(std::max(0, centre) / pool.sampleRate);
+    
+    juce::FloatVectorOperations::clear(filter, fftSize * 2);
+    for(auto bin = 0; bin < spectrumSize / 2; ++bin)
+        filter[bin * 2] = pool.binGains[bin] * std::exp(pool.dampingRates[bin] * seconds);
     
-    fftOrder = std::log2(fftSize);
-    fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+    //The wanted gains as a zero phase response, cut to bufferSize + 1 taps with a Hann window
+    fft->performRealOnlyInverseTransform(filter);
     
-    //Resize Arrays
-    fftBuffer.resize(fftSize * 2); //Ensure FFTbuffers are 2x fftSize
-    windowedFFT.resize(fftSize * 2);
-    overlapBuffer.resize(bufferSize);
+    auto halfTaps = bufferSize / 2;
+    for(auto n = 0; n < fftSize; ++n)
+    {
+        auto distance = std::min(n, fftSize - n);
+        filter[n] *= distance > halfTaps ? 0.0f
+                   : 0.5f + 0.5f * std::cos(juce::MathConstants<float>::pi * distance / (halfTaps + 1));
+    }
+    
+    //Still zero phase, so only the real parts are used
+    fft->performRealOnlyForwardTransform(filter, true);
 }
 
-
-
-void DynamicConvolverV2::loadNewIR(std::span<const float> newData)
+void DynamicConvolverV2::shapePartitions(SpectrumPool& pool, int slot, int first, int last, int numPartitions, float* scratch,
+                                         std::span<const float> samples)
 {
-    if (newData.empty())
-        return;
+    //The partition's samples are filtered together with halfTaps samples of each neighbour, which fills the transform,
+    //and only the partition's own samples are kept, so nothing wraps around and the slot still holds one fixed IR
+    auto halfTaps = bufferSize / 2;
+    auto* work = scratch;
+    auto* filter = scratch + fftSize * 2;
+    auto* window = scratch + fftSize * 4; //Previous, current and next partition
+    
+    auto loadSamples = [&](int partition, float* dest)
+    {
+        if(partition < 0 || partition >= numPartitions)
+        {
+            juce::FloatVectorOperations::clear(dest, bufferSize);
+            return;
+        }
+        
+        //Saves transforming the partition back
+        if(!samples.empty())
+        {
+            auto start = std::min(samples.size(), (size_t) partition * bufferSize);
+            auto numToCopy = static_cast<int>(std::min(samples.size() - start, (size_t) bufferSize));
+            juce::FloatVectorOperations::copy(dest, samples.data() + start, numToCopy);
+            juce::FloatVectorOperations::clear(dest + numToCopy, bufferSize - numToCopy);
+            return;
+        }
+        
+        juce::FloatVectorOperations::clear(work, fftSize * 2);
+        readPartition(sourcePool, slot, partition, work);
+        fft->performRealOnlyInverseTransform(work);
+        juce::FloatVectorOperations::copy(dest, work, bufferSize);
+    };
     
-    irData.assign(newData.begin(), newData.end());
-    createIRfft();
+    loadSamples(first - 1, window);
+    loadSamples(first, window + bufferSize);
+    
+    for(auto partition = first; partition < last; ++partition)
+    {
+        loadSamples(partition + 1, window + bufferSize * 2);
+        
+        //Without damping every partition has the same filter
+        if(partition == first || pool.isDamped)
+            designShapingFilter(pool, slot, partition, filter);
+        
+        juce::FloatVectorOperations::clear(work, fftSize * 2);
+        juce::FloatVectorOperations::copy(work, window + bufferSize - halfTaps, bufferSize + halfTaps * 2);
+        fft->performRealOnlyForwardTransform(work, true);
+        
+        for(auto bin = 0; bin < spectrumSize / 2; ++bin)
+        {
+            work[bin * 2] *= filter[bin * 2];
+            work[bin * 2 + 1] *= filter[bin * 2];
+        }
+        
+        fft->performRealOnlyInverseTransform(work);
+        std::copy(work + halfTaps, work + halfTaps + bufferSize, work);
+        juce::FloatVectorOperations::clear(work + bufferSize, fftSize * 2 - bufferSize);
+        fft->performRealOnlyForwardTransform(work, true);
+        writePartition(pool, slot, partition, work);
+        
+        std::copy(window + bufferSize, window + bufferSize * 3, window);
+    }
 }
 
-void DynamicConvolverV2::createIRfft()
+bool DynamicConvolverV2::updateShaping()
 {
-    //get number or partitions needed, and resize our partitions vector
-    //Partition size is 1/2 FFTsize,
-    int partitionSize = bufferSize;
-    int totalSamples = static_cast<int>(irData.size());
+    const juce::ScopedLock sl(shapingLock);
     
-    //Ensure that we get enough partitions to hold any number of samples, i.e. round up numPartitions
-    //Not sure why partion Size - 1, might be unnoticed mistake
-    numPartitions = (totalSamples + partitionSize - 1) / partitionSize;
+    auto version = shapingVersion.load();
+    if(bufferSize == 0)
+        return false;
     
-    //Arbitrary maximum of 400 partions
-    numPartitions = std::min(400, numPartitions);
+    if(version == shapedVersion)
+        return shapeCapture();
     
-    //Clear all currently loaded Data
-    clearBuffers();
+    DYNCONV_TRACE_SCOPE("Spectrum shaping");
     
-    //resize matrices
-    resizeMatrix(IRffts, (size_t) numPartitions, (size_t) fftSize * 2);
-    resizeMatrix(inputFFTbuffer, (size_t) numPartitions, (size_t) fftSize * 2);
+    shapedVersion = version;
     
-    juce::Logger::writeToLog("Num IR Partitions" + juce::String(numPartitions));
-    juce::Logger::writeToLog("IR Total Samples: " + juce::String(totalSamples));
+    //Captures are caught up by shapeCapture(), only other writes can have missed the pass
+    auto writesBefore = sourceWrites.load() - captureWrites.load();
     
-    //Copy data from loaded IR and split into partitions
-    for(auto i = 0; i < numPartitions; ++i)
+    if(isShapingFlat())
+    {
+        activePool.store(&sourcePool);
+        ++poolSwaps;
+        waitForPoolUsers();
+    }
+    else
     {
-        for(auto j = 0; j < partitionSize; ++j)
+        //Nothing has touched the pool that isn't playing since the last swap was waited out
+        auto& target = activePool.load() == &shapedPools[0] ? shapedPools[1] : shapedPools[0];
+        allocatePool(target);
+        computeShapingCurves(target);
+        
+        //Shaping turned on after prepare() isn't refused, the budget just counts it
+        account(bufferBytes, countBufferBytes());
+        
+        target.numCaptureShaped = 0;
+        
+        for(auto& mapped : storedSlots)
         {
-            auto index = j + i * partitionSize;
-            if(index < totalSamples)
+            auto stored = mapped.load();
+            
+            if(stored == captureStored.load())
             {
-                //only copy first channel for now
-                IRffts[i][j] = irData[index];
-            }else
-                IRffts[i][j] = 0.0f;
+                auto numFinal = getNumFinalCapturePartitions();
+                shapePartitions(target, stored, 0, numFinal, slots[stored].numPartitions.load(), shapingScratch.data());
+                target.numCaptureShaped = numFinal;
+                continue;
+            }
+            
+            auto numPartitions = slots[stored].numPartitions.load();
+            shapePartitions(target, stored, 0, numPartitions, numPartitions, shapingScratch.data());
         }
-        //perform fft on each partition
-        fft->performRealOnlyForwardTransform(IRffts[i].data());
+        
+        //The capture only plays as far as both pools have got until the old one is out of use
+        shapedCapturePartitions.store(std::min(shapedCapturePartitions.load(), target.numCaptureShaped));
+        activePool.store(&target);
+        ++poolSwaps;
+        waitForPoolUsers();
+        shapedCapturePartitions.store(target.numCaptureShaped);
     }
     
-    juce::Logger::writeToLog("IR FFT Created Successfully in DynamicConvolverV2!");
-    IRloaded = true;
+    //A partition stored during the pass may have missed the new pool, so go again
+    if(sourceWrites.load() - captureWrites.load() != writesBefore)
+        requestShapingUpdate();
+    
+    return true;
+}
+
+int DynamicConvolverV2::getNumFinalCapturePartitions() const
+{
+    //Running, the last partition is still missing the samples after it, captureSlot is read first as endCapture() clears it last
+    auto isRunning = captureSlot.load() >= 0;
+    auto numPartitions = slots[captureStored.load()].numPartitions.load();
+    return isRunning ? std::max(0, numPartitions - 1) : numPartitions;
+}
+
+bool DynamicConvolverV2::shapeCapture()
+{
+    auto stored = captureStored.load();
+    auto* pool = activePool.load();
+    
+    if(stored < 0 || pool == &sourcePool)
+        return false;
+    
+    auto numFinal = getNumFinalCapturePartitions();
+    auto first = pool->numCaptureShaped;
+    if(numFinal <= first)
+        return false;
+    
+    DYNCONV_TRACE_SCOPE("Capture shaping");
+    
+    //The audio thread doesn't read these partitions of the active pool before they're counted
+    shapePartitions(*pool, stored, first, numFinal, slots[stored].numPartitions.load(), shapingScratch.data());
+    pool->numCaptureShaped = numFinal;
+    shapedCapturePartitions.store(numFinal);
+    return true;
+}
+
+bool DynamicConvolverV2::isShapingCapture() const
+{
+    return captureStored.load() >= 0 && activePool.load() != &sourcePool;
 }
 
 void DynamicConvolverV2::clearBuffers()
@@ -97,17 +1266,258 @@ void DynamicConvolverV2::clearBuffers()
     for(auto& inner : inputFFTbuffer)
         juce::FloatVectorOperations::clear(inner.data(), inner.size());
     
-    for(auto& inner : IRffts)
-        juce::FloatVectorOperations::clear(inner.data(), inner.size());
-    
     juce::FloatVectorOperations::clear(overlapBuffer.data(), overlapBuffer.size());
+    
+    juce::FloatVectorOperations::clear(blockInput.data(), blockInput.size());
+    blockFill = 0;
+    isOverlapPending = false;
+}
+
+DynamicConvolverV2::WindowParameters DynamicConvolverV2::getWindowParameters() const
+{
+    return {filePosition.load(), fileLength.load(), dryWet.load(), slotA.load(), slotB.load(), morph.load(), reverse.load()};
 }
 
 void DynamicConvolverV2::process(std::span<float> buffer)
 {
-    if(!IRloaded)
+    process(buffer, getWindowParameters());
+}
+
+void DynamicConvolverV2::process(std::span<float> buffer, const WindowParameters& parameters)
+{
+    //Nothing prepared to convolve with, the input passes through untouched
+    if(bufferSize <= 0)
+        return;
+    
+    if(isOverlapPending)
+        restoreOverlap();
+    
+    //Split where the call crosses into the next block, so every segment lies within one block
+    for(size_t position = 0; position < buffer.size();)
+    {
+        auto numSamples = std::min(buffer.size() - position, static_cast<size_t>(bufferSize - blockFill));
+        processSegment(buffer.subspan(position, numSamples), parameters);
+        position += numSamples;
+    }
+}
+
+void DynamicConvolverV2::processSegment(std::span<float> buffer, const WindowParameters& parameters)
+{
+    auto played = parameters;
+    
+    //Each cut re-transforms the whole window, so it only moves where a block starts, and keeps its place for the rest of it
+    if(windowGrid > 0)
+    {
+        if(blockFill == 0)
+            gridBlockParameters = parameters;
+        
+        played.filePos = gridBlockParameters.filePos;
+        played.fileLen = gridBlockParameters.fileLen;
+        played.reverse = gridBlockParameters.reverse;
+        played = cutGridWindows(played);
+    }
+    
+    //Only after the grid windows, a load waits for the pool users while it holds the lock they're cut under
+    const ScopedPoolUser user(poolUsers);
+    
+    //Nothing to play, whatever comes next starts a new block
+    if(!selectWindow(played, blockFill > 0))
+    {
+        blockFill = 0;
+        return;
+    }
+    
+    float mixAmt = parameters.dryWet;
+    
+    //A segment covering a whole block is convolved in one go, anything shorter goes through the partial block
+    if(blockFill == 0 && static_cast<int>(buffer.size()) == bufferSize)
+    {
+        convolveBlock(buffer, mixAmt);
+        return;
+    }
+    
+    convolvePartialBlock(buffer, mixAmt);
+}
+
+DynamicConvolverV2::WindowParameters DynamicConvolverV2::cutGridWindows(const WindowParameters& parameters)
+{
+    //Grid engines hold only the window, already reversed, so the whole of it is played forwards
+    updateGridWindow(parameters.slotA, parameters.filePos, parameters.fileLen, parameters.reverse);
+    
+    if(parameters.slotB != parameters.slotA)
+        updateGridWindow(parameters.slotB, parameters.filePos, parameters.fileLen, parameters.reverse);
+    
+    auto played = parameters;
+    played.filePos = 0.0f;
+    played.fileLen = 1.0f;
+    played.reverse = false;
+    return played;
+}
+
+bool DynamicConvolverV2::selectWindow(const WindowParameters& parameters, bool firstPlayedOnly)
+{
+    int currentSlotA = parameters.slotA;
+    int currentSlotB = parameters.slotB;
+    float morphAmt = parameters.morph;
+    
+    float filePos = parameters.filePos;
+    float fileLen = parameters.fileLen;
+    bool reversed = parameters.reverse;
+    
+    //Swaps are counted after the pool is stored, so reading them first never pairs a new count with an old pool
+    blockPoolSwaps = poolSwaps.load();
+    blockPool = activePool.load();
+    
+    //A load swaps its slot to another stored slot, read once so the whole segment plays the same one
+    auto storedA = storedSlots[currentSlotA].load();
+    auto storedB = storedSlots[currentSlotB].load();
+    int partitionsA = slots[storedA].numPartitions.load();
+    int partitionsB = slots[storedB].numPartitions.load();
+    
+    //A capture is only played as far as it has been shaped
+    if(blockPool != &sourcePool)
+    {
+        auto capturing = captureStored.load();
+        
+        if(storedA == capturing)
+            partitionsA = std::min(partitionsA, shapedCapturePartitions.load());
+        
+        if(storedB == capturing)
+            partitionsB = std::min(partitionsB, shapedCapturePartitions.load());
+    }
+    
+    //Morph weights carry each slot's gain, so the MAC output needs no further scaling
+    float weightA = (1.0f - morphAmt) * slots[storedA].gain.load();
+    float weightB = morphAmt * slots[storedB].gain.load();
+    
+    if(currentSlotB == currentSlotA || partitionsB == 0 || weightB == 0.0f)
+    {
+        weightA = slots[storedA].gain.load();
+        partitionsB = 0;
+    }
+    else if(partitionsA == 0 || weightA == 0.0f)
+    {
+        partitionsA = 0;
+        weightB = slots[storedB].gain.load();
+    }
+    
+    if(partitionsA == 0 && partitionsB == 0)
+        return false;
+    
+    //Indecies for Moving File, the window covers the same fraction of each slot
+    //It's cut to the sample, but stays on the partition grid, so its edges are the only partitions that change
+    //Grid engines had their window limited when it was cut out
+    auto maxLength = windowGrid > 0 ? 0 : windowLimit;
+    
+    //Inside a started block only the first partition is convolved, the rest of the window was summed when the block started
+    auto getWindow = [this, filePos, fileLen, maxLength, firstPlayedOnly, reversed](int slot, int numPartitions, int& startSample, int& endSample, int& startIndx)
+    {
+        if(numPartitions == 0)
+            return 0;
+        
+        //Read after the partitions, which are published last, and kept within them should a reload finish in between
+        auto numSamples = std::min(slots[slot].numSamples.load(), numPartitions * bufferSize);
+        getWindowRange(filePos, fileLen, numSamples, maxLength, startSample, endSample);
+        updateWindowEdges(slot, startSample, endSample, firstPlayedOnly, reversed);
+        
+        startIndx = startSample / bufferSize;
+        return endSample > startSample ? (endSample + bufferSize - 1) / bufferSize - startIndx : 0;
+    };
+    
+    int startA = 0, startB = 0;
+    int startSampleA = 0, endSampleA = 0, startSampleB = 0, endSampleB = 0;
+    int lengthA = getWindow(storedA, partitionsA, startSampleA, endSampleA, startA);
+    int lengthB = getWindow(storedB, partitionsB, startSampleB, endSampleB, startB);
+    setWindow(storedA, startA, lengthA, weightA, storedB, startB, lengthB, weightB, reversed);
+    return true;
+}
+
+void DynamicConvolverV2::feedHistory(std::span<const float> buffer, const WindowParameters& parameters)
+{
+    if(bufferSize <= 0)
+        return;
+    
+    DYNCONV_TRACE_SCOPE("Fed input");
+    auto ringSize = static_cast<int>(inputFFTbuffer.size());
+    
+    //Blocks take their place in the history as they start, as played ones do, and are transformed once they're full
+    for(size_t position = 0; position < buffer.size();)
+    {
+        auto numSamples = std::min(buffer.size() - position, static_cast<size_t>(bufferSize - blockFill));
+        
+        if(blockFill == 0)
+            inputFftIndex = (inputFftIndex + 1) % ringSize;
+        
+        juce::FloatVectorOperations::copy(blockInput.data() + blockFill, buffer.data() + position, numSamples);
+        blockFill += static_cast<int>(numSamples);
+        position += numSamples;
+        
+        if(blockFill == bufferSize)
+        {
+            juce::FloatVectorOperations::clear(fftBuffer.data(), fftBuffer.size());
+            juce::FloatVectorOperations::copy(fftBuffer.data(), blockInput.data(), bufferSize);
+            fft->performRealOnlyForwardTransform(fftBuffer.data(), true);
+            juce::FloatVectorOperations::copy(inputFFTbuffer[inputFftIndex].data(), fftBuffer.data(), spectrumSize);
+            blockFill = 0;
+        }
+    }
+    
+    fedParameters = parameters;
+    isOverlapPending = true;
+}
+
+void DynamicConvolverV2::restoreOverlap()
+{
+    isOverlapPending = false;
+    juce::FloatVectorOperations::clear(overlapBuffer.data(), overlapBuffer.size());
+    
+    auto played = fedParameters;
+    if(windowGrid > 0)
+    {
+        gridBlockParameters = fedParameters;
+        played = cutGridWindows(fedParameters);
+    }
+    
+    const ScopedPoolUser user(poolUsers);
+    
+    if(!selectWindow(played, false))
         return;
     
+    DYNCONV_TRACE_SCOPE("Overlap restore");
+    
+    //The last full block, one behind the block still being filled
+    auto ringSize = static_cast<int>(inputFFTbuffer.size());
+    auto current = inputFftIndex;
+    
+    if(blockFill > 0)
+        inputFftIndex = (inputFftIndex + ringSize - 1) % ringSize;
+    
+    juce::FloatVectorOperations::clear(windowedFFT.data(), windowedFFT.size());
+    convolveWithWindow(0);
+    
+    if(window.reversed)
+        applyReversePhase();
+    
+    fft->performRealOnlyInverseTransform(windowedFFT.data());
+    juce::FloatVectorOperations::copy(overlapBuffer.data(), windowedFFT.data() + bufferSize, overlapBuffer.size());
+    inputFftIndex = current;
+    
+    //A block that was started is carried on with the history output it would have summed when it did
+    if(blockFill > 0)
+    {
+        juce::FloatVectorOperations::clear(windowedFFT.data(), windowedFFT.size());
+        convolveWithWindow(1);
+        
+        if(window.reversed)
+            applyReversePhase();
+        
+        fft->performRealOnlyInverseTransform(windowedFFT.data());
+        juce::FloatVectorOperations::copy(historyOutput.data(), windowedFFT.data(), historyOutput.size());
+    }
+}
+
+void DynamicConvolverV2::convolveBlock(std::span<float> buffer, float mixAmt)
+{
     //zero pad data and copy input
     juce::FloatVectorOperations::clear(fftBuffer.data(), fftBuffer.size());
     juce::FloatVectorOperations::copy(fftBuffer.data(), buffer.data(), buffer.size());
@@ -115,23 +1525,27 @@ void DynamicConvolverV2::process(std::span<float> buffer)
     juce::FloatVectorOperations::clear(windowedFFT.data(), windowedFFT.size());
     
     //perform FFT and add to buffer
-    fft->performRealOnlyForwardTransform(fftBuffer.data());
-    addNewInputFFT(fftBuffer);
-    
-    
-    float filePos = filePosition.load();
-    float fileLen = fileLength.load();
-    float mixAmt = dryWet.load();
-    
-    //Indecies for Moving File
-    int startIndx = static_cast<int>(filePos * numPartitions);
-    int endIndx = static_cast<int>(fileLen * numPartitions + startIndx);
-    endIndx = endIndx > numPartitions ? numPartitions : endIndx;
+    {
+        DYNCONV_TRACE_SCOPE("Forward FFT");
+        fft->performRealOnlyForwardTransform(fftBuffer.data(), true);
+        addNewInputFFT(fftBuffer);
+    }
     
-    convolveWithWindow(startIndx, endIndx);
+    {
+        DYNCONV_TRACE_SCOPE("MAC");
+        convolveWithWindow(0);
+        
+        if(window.reversed)
+            applyReversePhase();
+    }
     
     //perform IFT on sum
-    fft->performRealOnlyInverseTransform(windowedFFT.data());
+    {
+        DYNCONV_TRACE_SCOPE("Inverse FFT");
+        fft->performRealOnlyInverseTransform(windowedFFT.data());
+    }
+    
+    DYNCONV_TRACE_SCOPE("Overlap-add");
     
     //Sum result and last overlap to output
     for(auto i = 0; i < bufferSize; ++i)
@@ -139,38 +1553,167 @@ void DynamicConvolverV2::process(std::span<float> buffer)
         buffer[i] = (windowedFFT[i] + overlapBuffer[i]) * mixAmt + (1.0 - mixAmt) * buffer[i];
     }
     
-    //copy second quarter of array
-    size_t quarterArray = windowedFFT.size()/4 ;
-    juce::FloatVectorOperations::copy(overlapBuffer.data(), windowedFFT.data() + quarterArray, overlapBuffer.size());
+    //Second half of the inverse FFT result is carried over to the next block
+    juce::FloatVectorOperations::copy(overlapBuffer.data(), windowedFFT.data() + bufferSize, overlapBuffer.size());
+}
+
+void DynamicConvolverV2::convolvePartialBlock(std::span<float> buffer, float mixAmt)
+{
+    auto numSamples = static_cast<int>(buffer.size());
+    
+    //The block takes its place in the input history as soon as it starts, and is filled in as it arrives
+    //Every partition but the first only hears finished blocks, so they're summed once, with the window the block starts with,
+    //the same one a whole block would have used. Summing them again on every window move cost more than the rest of the call
+    if(blockFill == 0)
+    {
+        inputFftIndex = (inputFftIndex + 1) % static_cast<int>(inputFFTbuffer.size());
+        
+        DYNCONV_TRACE_SCOPE("History MAC");
+        juce::FloatVectorOperations::clear(windowedFFT.data(), windowedFFT.size());
+        convolveWithWindow(1);
+        
+        if(window.reversed)
+            applyReversePhase();
+        
+        fft->performRealOnlyInverseTransform(windowedFFT.data());
+        juce::FloatVectorOperations::copy(historyOutput.data(), windowedFFT.data(), historyOutput.size());
+    }
+    
+    juce::FloatVectorOperations::copy(blockInput.data() + blockFill, buffer.data(), numSamples);
+    
+    //The first partition hears the block so far, zero padded, the samples still to come can't reach these outputs
+    {
+        DYNCONV_TRACE_SCOPE("Forward FFT");
+        juce::FloatVectorOperations::clear(fftBuffer.data(), fftBuffer.size());
+        juce::FloatVectorOperations::copy(fftBuffer.data(), blockInput.data(), blockFill + numSamples);
+        fft->performRealOnlyForwardTransform(fftBuffer.data(), true);
+        juce::FloatVectorOperations::copy(inputFFTbuffer[inputFftIndex].data(), fftBuffer.data(), spectrumSize);
+    }
+    
+    {
+        DYNCONV_TRACE_SCOPE("MAC");
+        juce::FloatVectorOperations::clear(windowedFFT.data(), windowedFFT.size());
+        
+        if(window.reversed)
+            accumulateWindow<true>(0, std::min(1, window.length), windowedFFT.data());
+        else
+            accumulateWindow<false>(0, std::min(1, window.length), windowedFFT.data());
+        
+        if(window.reversed)
+            applyReversePhase();
+    }
+    
+    {
+        DYNCONV_TRACE_SCOPE("Inverse FFT");
+        fft->performRealOnlyInverseTransform(windowedFFT.data());
+    }
+    
+    DYNCONV_TRACE_SCOPE("Overlap-add");
+    
+    for(auto i = 0; i < numSamples; ++i)
+    {
+        auto n = blockFill + i;
+        buffer[i] = (windowedFFT[n] + historyOutput[n] + overlapBuffer[n]) * mixAmt + (1.0 - mixAmt) * buffer[i];
+    }
+    
+    blockFill += numSamples;
+    
+    //Block complete, its tail and the history's are carried over as usual
+    if(blockFill == bufferSize)
+    {
+        juce::FloatVectorOperations::add(overlapBuffer.data(), windowedFFT.data() + bufferSize, historyOutput.data() + bufferSize, bufferSize);
+        blockFill = 0;
+    }
 }
 
 void DynamicConvolverV2::addNewInputFFT(std::span<float> newFFT)
 {
     inputFftIndex += 1;
     
-    if (inputFftIndex >= inputFFTbuffer.size())
+    if (inputFftIndex >= static_cast<int>(inputFFTbuffer.size()))
         inputFftIndex = 0;
     
     //copy data from input to buffer
-    juce::FloatVectorOperations::copy(inputFFTbuffer[inputFftIndex].data(), newFFT.data(), newFFT.size());
+    juce::FloatVectorOperations::copy(inputFFTbuffer[inputFftIndex].data(), newFFT.data(), spectrumSize);
+}
+
+template <bool conjugate>
+void DynamicConvolverV2::multiplyAccumulate(const float* input, const float* irFFT, float weight, float* output, int numValues)
+{
+    //JUCE's real-only FFT stores interleaved complex bins, starting with DC
+    //The inverse transform only reads bins 0 to fftSize/2, so the mirrored upper half is skipped
+    const float imWeight = conjugate ? -weight : weight;
+    
+    for(int i = 0; i < numValues; i += 2)
+    {
+        float realA = input[i];
+        float imA = input[i+1];
+        float realB = irFFT[i] * weight;
+        float imB = irFFT[i+1] * imWeight;
+        
+        output[i] += realA * realB - imA * imB;
+        output[i+1] += realA * imB + imA * realB;
+    }
 }
 
-void DynamicConvolverV2::multiplyFFTs(const std::span<float> input, const std::span<float> irFFT, std::span<float> output)
+template <bool conjugate>
+void DynamicConvolverV2::multiplyAccumulateMorph(const float* input, const float* irA, float weightA,
+                                                 const float* irB, float weightB, float* output, int numValues)
 {
-    //First Two data points correspond to DC and Nyquist frequency
-    //The rest of the values are interleaved complex values for each bin
-    output[0] = input[0] * irFFT[0];
-    output[1] = input[1] * irFFT[1];
+    //Same as multiplyAccumulate, with the IR spectrum interpolated between two slots on the fly
+    const float imWeightA = conjugate ? -weightA : weightA;
+    const float imWeightB = conjugate ? -weightB : weightB;
     
-    for(int i = 2; i < input.size(); i += 2)
+    for(int i = 0; i < numValues; i += 2)
     {
         float realA = input[i];
-        float realB = irFFT[i];
         float imA = input[i+1];
-        float imB = irFFT[i+1];
+        float realB = irA[i] * weightA + irB[i] * weightB;
+        float imB = irA[i+1] * imWeightA + irB[i+1] * imWeightB;
+        
+        output[i] += realA * realB - imA * imB;
+        output[i+1] += realA * imB + imA * realB;
+    }
+}
+
+void DynamicConvolverV2::widenCompactBlock(const SpectrumPool& pool, int slot, int partition, int block, float weight, float* dest, bool accumulate) const
+{
+    auto index = getStoredIndex(partition) * numCompactBlocks + (size_t) block;
+    auto* values = pool.compact[slot].data() + index * compactBlockSize;
+    auto scale = pool.scales[slot][index] * weight;
+    
+    if(accumulate)
+    {
+        for(auto i = 0; i < compactBlockSize; ++i)
+            dest[i] += static_cast<float>(values[i]) * scale;
+    }
+    else
+    {
+        for(auto i = 0; i < compactBlockSize; ++i)
+            dest[i] = static_cast<float>(values[i]) * scale;
+    }
+}
+
+template <bool conjugate>
+void DynamicConvolverV2::multiplyAccumulateCompact(const float* input, int slotA, int partitionA, float weightA,
+                                                   int slotB, int partitionB, float weightB, float* output)
+{
+    //IR values are widened a block at a time, so they never leave L1 as floats
+    //A negative partition means that slot doesn't take part
+    float widened[compactBlockSize];
+    
+    for(auto block = 0; block < numCompactBlocks; ++block)
+    {
+        auto offset = block * compactBlockSize;
+        auto numValues = std::min(compactBlockSize, spectrumSize - offset);
+        
+        if(partitionA >= 0)
+            widenCompactBlock(*blockPool, slotA, partitionA, block, weightA, widened, false);
         
-        output[i] = realA * realB - imA * imB;
+        if(partitionB >= 0)
+            widenCompactBlock(*blockPool, slotB, partitionB, block, weightB, widened, partitionA >= 0);
         
+        multiplyAccumulate<conjugate>(input + offset, widened, 1.0f, output + offset, numValues);
     }
 }
 
@@ -181,17 +1724,107 @@ void DynamicConvolverV2::resizeMatrix(std::vector<std::vector<float>> &matrix, s
         index.resize(inside, 0.0);
 }
 
-void DynamicConvolverV2::convolveWithWindow(int startIndex, int endIndex)
+void DynamicConvolverV2::setWindow(int slotA, int startA, int lengthA, float weightA,
+                                   int slotB, int startB, int lengthB, float weightB, bool reversed)
 {
-    for(int i = startIndex;  i < endIndex; i++)
+    window = {slotA, startA, lengthA, slotB, startB, lengthB, weightA, weightB, reversed, 0, std::max(lengthA, lengthB), 0};
+}
+
+void DynamicConvolverV2::convolveWithWindow(int first)
+{
+    window.first = std::min(first, window.length);
+    
+    auto numChunks = 1;
+    if(scheduler != nullptr && !partialSums.empty())
+        numChunks = std::min({maxChunks, scheduler->getNumWorkers() + 1, (window.length - window.first) / minPartitionsPerChunk});
+    
+    if(numChunks < 2)
+    {
+        if(window.reversed)
+            accumulateWindow<true>(window.first, window.length, windowedFFT.data());
+        else
+            accumulateWindow<false>(window.first, window.length, windowedFFT.data());
+        return;
+    }
+    
+    window.chunkLength = (window.length - window.first + numChunks - 1) / numChunks;
+    scheduler->run(jobGroup, numChunks);
+    
+    for(auto chunk = 0; chunk < numChunks; ++chunk)
+        juce::FloatVectorOperations::add(windowedFFT.data(), partialSums[chunk].data(), spectrumSize);
+}
+
+void DynamicConvolverV2::runWindowChunk(void* context, int chunk)
+{
+    DYNCONV_TRACE_SCOPE("MAC chunk");
+    
+    auto& self = *static_cast<DynamicConvolverV2*>(context);
+    auto* output = self.partialSums[chunk].data();
+    
+    auto first = std::min(self.window.first + chunk * self.window.chunkLength, self.window.length);
+    auto last = std::min(first + self.window.chunkLength, self.window.length);
+    
+    juce::FloatVectorOperations::clear(output, self.spectrumSize);
+    
+    if(self.window.reversed)
+        self.accumulateWindow<true>(first, last, output);
+    else
+        self.accumulateWindow<false>(first, last, output);
+}
+
+template <bool reversed>
+void DynamicConvolverV2::accumulateWindow(int first, int last, float* output)
+{
+    auto ringSize = static_cast<int>(inputFFTbuffer.size());
+    auto& w = window;
+    
+    //Reversed, the window's partitions are walked from its end and conjugated
+    //The delay that completes the reversal is the same for every partition, so it's applied once to the sum
+    auto getPartition = [](int start, int length, int i) { return reversed ? start + length - 1 - i : start + i; };
+    
+    //Partitions cut by the window are read from the slot's edges instead
+    auto& edgesA = activeEdges[w.slotA];
+    auto& edgesB = activeEdges[w.slotB];
+    auto toStored = [](int partition, const std::array<int, numEdgePartitions>& edges)
     {
-        auto currentFFTindex = ((inputFftIndex + numPartitions) - (i - startIndex)) % numPartitions;
+        if(partition >= 0 && partition == edges[0])
+            return maxPartitions;
         
-        //Multiply Input with IR, Scale down result, add to window buffer
-        multiplyFFTs(inputFFTbuffer[currentFFTindex], IRffts[i], fftBuffer);
+        if(partition >= 0 && partition == edges[1])
+            return maxPartitions + 1;
+        
+        return partition;
+    };
     
-        juce::FloatVectorOperations::multiply(fftBuffer.data(), 1.0/numPartitions, fftBuffer.size());
-        juce::FloatVectorOperations::add(windowedFFT.data(), fftBuffer.data(), fftBuffer.size());
+    for(int i = first; i < last; i++)
+    {
+        auto currentFFTindex = ((inputFftIndex + ringSize) - i) % ringSize;
+        auto* input = inputFFTbuffer[currentFFTindex].data();
+        auto partitionA = i < w.lengthA ? toStored(getPartition(w.startA, w.lengthA, i), edgesA) : -1;
+        auto partitionB = i < w.lengthB ? toStored(getPartition(w.startB, w.lengthB, i), edgesB) : -1;
+        
+        //Multiply Input with IR, add to window buffer
+        if(storage == SpectrumStorage::compact)
+            multiplyAccumulateCompact<reversed>(input, w.slotA, partitionA, w.weightA, w.slotB, partitionB, w.weightB, output);
+        else if(partitionA >= 0 && partitionB >= 0)
+            multiplyAccumulateMorph<reversed>(input, getSlotPartition(*blockPool, w.slotA, partitionA), w.weightA,
+                                              getSlotPartition(*blockPool, w.slotB, partitionB), w.weightB, output, spectrumSize);
+        else if(partitionA >= 0)
+            multiplyAccumulate<reversed>(input, getSlotPartition(*blockPool, w.slotA, partitionA), w.weightA, output, spectrumSize);
+        else
+            multiplyAccumulate<reversed>(input, getSlotPartition(*blockPool, w.slotB, partitionB), w.weightB, output, spectrumSize);
+    }
+}
+
+void DynamicConvolverV2::applyReversePhase()
+{
+    for(auto i = 0; i < spectrumSize; i += 2)
+    {
+        auto real = windowedFFT[i];
+        auto im = windowedFFT[i + 1];
+        
+        windowedFFT[i] = real * reversePhase[i] - im * reversePhase[i + 1];
+        windowedFFT[i + 1] = real * reversePhase[i + 1] + im * reversePhase[i];
     }
 }
 
@@ -204,4 +1837,24 @@ void DynamicConvolverV2::parameterChanged(const juce::String& parameterID, float
         fileLength.store(newValue);
     else if(parameterID == "DRY_WET")
         dryWet.store(newValue);
+    else if(parameterID == "SLOT_A")
+        slotA.store(juce::jlimit(0, numSlots - 1, juce::roundToInt(newValue) - 1));
+    else if(parameterID == "SLOT_B")
+        slotB.store(juce::jlimit(0, numSlots - 1, juce::roundToInt(newValue) - 1));
+    else if(parameterID == "MORPH")
+        morph.store(newValue);
+    else if(parameterID == "REVERSE")
+        reverse.store(newValue >= 0.5f);
+    else if(parameterID == "LOW_CUT")
+        lowCut.store(newValue);
+    else if(parameterID == "HIGH_CUT")
+        highCut.store(newValue);
+    else if(parameterID == "TILT")
+        tilt.store(newValue);
+    else if(parameterID == "DAMPING")
+        damping.store(newValue);
+    
+    //The shaping is applied to the stored spectra, off the audio thread
+    if(parameterID == "LOW_CUT" || parameterID == "HIGH_CUT" || parameterID == "TILT" || parameterID == "DAMPING")
+        requestShapingUpdate();
 }
@@ -14,74 +14,502 @@
 
 #include <stdio.h>
 
+#include "DSPScheduler.h"
+#include "MemoryBudget.h"
+
 
 #include <juce_core/juce_core.h>
 #include <juce_dsp/juce_dsp.h>
 #include <juce_audio_processors/juce_audio_processors.h>
 
+#include <array>
 #include <span>
 #include <vector>
 #include <complex.h>
 #include <memory.h>
 
 
+class SpectrumShaper;
+
 class DynamicConvolverV2 : juce::AudioProcessorValueTreeState::Listener
 {
 public:
+    
+    //Each slot holds the partition spectra of one IR, the MAC pass morphs between two of them
+    static constexpr int numSlots = 4;
+    
+    //Arbitrary maximum of 400 partions per slot, the default capacity of prepare()
+    static constexpr int maxPartitions = 400;
+    
+    //full keeps the IR spectra as floats, compact keeps them as int16 with one float scale per
+    //compactBlockSize values, which halves their memory, but widening them cost the MAC pass
+    //about a quarter more CPU in every case the engine tests time, so it's for saving memory
+    enum class SpectrumStorage { full, compact };
 
     DynamicConvolverV2(juce::AudioProcessorValueTreeState& vts);
+    DynamicConvolverV2(); //Standalone use without a plugin, set parameters with setParameters()
+    ~DynamicConvolverV2() override;
+    
+    //partitionCapacity is the most partitions a slot can hold, large blocks need fewer for the same IR length
+    void prepare(int blockSize, int partitionCapacity = maxPartitions);
+    void reset(); //Clears the input history and overlap, allocates nothing
+    
+    //Frees the spectra and history prepare() allocated, the IRs are kept, prepare() again before processing
+    void release();
+    
+    //Longest the output can keep ringing once the input has stopped, in samples
+    int getTailLength() const;
+    //False for a slot that is being captured, or whose capture hasn't been committed yet, the slot keeps the capture
+    bool loadNewIR(std::span<const float> newData, int slot = 0);
+    
+    //Samples of the IR in slot, as loaded or captured, not for the audio thread
+    std::vector<float> getIRData(int slot) const;
     
-    void prepare(int blockSize);
-    void loadNewIR(std::span<const float> newData);
+    //Re-partitions the IRs of another engine at this engine's block size, used to mirror a differently prepared engine
+    void copyIRsFrom(const DynamicConvolverV2& other);
+    
+    //Non-zero for engines running large partitions on behalf of an engine prepared with gridSize
+    //The window, gain and reverse are worked out on that grid, and the window is cut out of the IR and
+    //partitioned again whenever it changes, so the output matches the smaller engine
+    //Rebuilding takes a lock and several FFTs, so only use it where the thread isn't realtime
+    void setWindowGrid(int gridSize);
+    
+    //Everything process() reads from the parameters, taken once per call
+    struct WindowParameters
+    {
+        float filePos = 0.0f;
+        float fileLen = 1.0f;
+        float dryWet = 0.5f;
+        int slotA = 0;
+        int slotB = 1;
+        float morph = 0.0f;
+        bool reverse = false;
+        
+        bool operator==(const WindowParameters&) const = default;
+    };
+    
+    //Calls can be any length, blocks the host splits at automation points included
+    //A change between two calls reaches the mix and the window's first partition on the first sample of the second,
+    //the rest of the window follows from the next block, however the audio was cut into calls
+    //Before prepare(), or after release(), the buffer is left as it is
     void process(std::span<float> buffer);
+    void process(std::span<float> buffer, const WindowParameters& parameters);
+    WindowParameters getWindowParameters() const;
+    
+    //Takes the input into the history without playing it, for an engine that only plays some stretches of a stream
+    //The next process() first works out the overlap it would have carried, as if the blocks fed had played with parameters
+    void feedHistory(std::span<const float> buffer, const WindowParameters& parameters);
+    
+    void setParameters(float newFilePos, float newFileLen, float newDryWet);
+    void setMorph(int newSlotA, int newSlotB, float newMorph);
+    void setReverse(bool shouldReverse);
+    
+    //Tone shaping, each partition of the IR is filtered with a zero phase FIR of up to bufferSize + 1 taps,
+    //so the IR keeps its timing, and the finest detail the curves keep is about sampleRate / bufferSize wide
+    //Cuts are in Hz and off at their limits, tilt is in dB per octave around 1kHz, and damping (0-1)
+    //takes the highs down further the later a partition sits in the IR
+    void setShaping(float newLowCutHz, float newHighCutHz, float newTiltDb, float newDamping);
+    void setSampleRate(double newSampleRate);
+    
+    //Rebuilds the shaped spectra once the shaping or an IR has changed, false if there was nothing to do
+    //A pass over the stored spectra, off the audio thread, which keeps playing the last ones until they're swapped
+    //It also shapes the partitions a capture has added, which are only played once it has
+    bool updateShaping();
+    
+    //True while a capture is waiting on updateShaping() for its shaped partitions, nothing else wakes the shaper for them
+    bool isShapingCapture() const;
+    
+    //Optional, wakes the thread that calls updateShaping()
+    void setShaper(SpectrumShaper* newShaper);
+    
+    //Takes effect on the next prepare()
+    void setSpectrumStorage(SpectrumStorage newStorage);
+    size_t getSpectrumMemoryBytes() const;
+    
+    //Longest window in samples, the input history is only sized to hold that much, 0 for the whole slot
+    //Longer windows are cut short at their end, takes effect on the next prepare()
+    void setMaxWindowLength(int numSamples);
+    
+    //Optional, shared by the engines that have to stay within it, the layout takes effect on the next prepare()
+    //An engine that doesn't fit stores its spectra compact, then halves its longest window, then its partition capacity,
+    //which cuts the end off IRs longer than it holds. Loads get as many partitions as the rest of the budget holds,
+    //and the shaped pools aren't planned for, they're counted once allocated
+    void setMemoryBudget(MemoryBudget* newBudget);
+    
+    //What the last prepare() settled on within the budget
+    SpectrumStorage getSpectrumStorage() const { return storage; }
+    int getPartitionCapacity() const { return partitionsPerSlot; }
+    int getMaxWindowLength() const { return windowLimit; }
+    
+    //Samples cut off the end of the IR in slot, by the partition capacity or the budget, 0 when all of it plays
+    int getNumDroppedSamples(int slot) const;
+    
+    //Bytes allocated for the spectra, input history, IR data and buffers, all but the FFT's own tables
+    //The same count the budget holds for this engine, safe to call from any thread
+    size_t getMemoryBytes() const;
+    
+    //Optional, long windows split their MAC pass into chunks run on the shared workers
+    void setScheduler(DSPScheduler* newScheduler);
+    
+    //Live capture, records incoming audio as the IR of a slot
+    //Each partition is transformed as soon as it's full, so the slot grows while it's being played
+    //begin/capture/end run on the audio thread, commitCapture on the message thread once it has ended
+    bool beginCapture(int slot);
+    void captureBlock(std::span<const float> input);
+    void endCapture();
+    void commitCapture();
 
     void parameterChanged(const juce::String& parameterID, float newValue) override;
     
 private:
     
+    //A load is built in the stored slot no slot is mapped to, and swapped in once it's complete,
+    //so the audio thread never reads spectra while they're rewritten
+    static constexpr int numStoredSlots = numSlots + 1;
+    
+    //Spectra and state of one IR, a slot plays whichever stored slot it's mapped to
+    struct IRSlot
+    {
+        std::atomic<int> numPartitions {0}; //0 while empty
+        std::atomic<float> gain {1.0f};
+        
+        //Samples of the IR the partitions hold, without the padding of the last one
+        //The gain and window are worked out on it, so neither depends on the partition size
+        std::atomic<int> numSamples {0};
+        
+        //Samples at the end of the IR that didn't fit the partition capacity or the budget, and don't play
+        std::atomic<int> numDroppedSamples {0};
+        
+        //Sample of the IR the first partition starts at, and which way the partitions run, for damping
+        std::atomic<int> dampingOrigin {0};
+        std::atomic<int> dampingDirection {1};
+    };
+    
+    //Partition spectra of every stored slot, in the engine's SpectrumStorage
+    //Each stored slot is an allocation of its own, its window edges followed by as many partitions as it holds
+    struct SpectrumPool
+    {
+        std::array<std::vector<float>, numStoredSlots> spectra;
+        std::array<std::vector<juce::int16>, numStoredSlots> compact;
+        std::array<std::vector<float>, numStoredSlots> scales;
+        std::array<int, numStoredSlots> capacities {};
+        bool isAllocated = false;
+        
+        //Shaping the spectra were built with, gain per bin and damping as log gain per bin per second
+        std::vector<float> binGains;
+        std::vector<float> dampingRates;
+        double sampleRate = 44100.0;
+        bool isDamped = false;
+        
+        //Partitions of the running capture shaped into this pool, under shapingLock
+        int numCaptureShaped = 0;
+    };
+    
+    //Window grid, the spectra of each slot hold the window cut out at start/end rather than the whole IR
+    //The parameters it was cut for are kept, so a load can cut the same window from the new IR
+    struct GridWindow
+    {
+        int start = -1;
+        int end = -1;
+        int cutStart = -1;
+        int cutEnd = -1;
+        bool reversed = false;
+        juce::uint32 irVersion = 0;
+        float filePos = 0.0f;
+        float fileLen = 0.0f;
+    };
+    
+    //Counts the threads reading or writing the active pool, so a retired pool isn't reused under them
+    struct ScopedPoolUser
+    {
+        explicit ScopedPoolUser(std::atomic<int>& counter) : users(counter) { ++users; }
+        ~ScopedPoolUser() { --users; }
+        
+        std::atomic<int>& users;
+    };
+    
     //From FastConvV2 ============================
     void clearBuffers();
-    void createIRfft();
+    //Built in stored, the spare the caller claimed
+    void createIRfft(int slot, int stored);
+    int getSpareSlot() const;
+    
+    //Most of numPartitions the budget has room for, the slot's current ones are handed back by the load
+    int fitToBudget(int numPartitions, int replacedPartitions);
+    
+    //A load claims the spare stored slot, waiting out a capture that's swapping it in, before it checks the slot isn't
+    //being captured, and hands it back once the slot it replaced is spare, sized for captures again
+    int claimSpareSlot();
+    void releaseSpareSlot();
+    
+    //Grid engines build a load like createIRfft(), with the window the slot is playing cut from the new IR
+    void createGridSlot(int slot, int stored);
+    void updateGridWindow(int slot, float filePos, float fileLen, bool reversed);
+    GridWindow getGridWindow(int slot, float filePos, float fileLen, bool reversed) const;
+    void cutGridWindow(int slot, int stored, const GridWindow& window);
+    int getGridCapacity(int totalSamples) const;
+    void storeGridDroppedSamples(int slot, int stored);
+    
+    //Hands a capture that has ended over to irData, under irDataLock
+    bool storeCapturedIR();
+    
+    //Window of a slot holding totalSamples, start and end are cut to the sample, and the end to maxLength (0 for none)
+    static void getWindowRange(float filePos, float fileLen, int totalSamples, int maxLength, int& startSample, int& endSample);
+    
+    //Partitions the window only covers part of are transformed again with the rest zeroed,
+    //so only the two edges change as the window moves, however long it is
+    //From here on slot means a stored slot, the MAC pass and the pools only know those
+    //firstPlayedOnly builds just the edge the window starts playing from, all a call inside a started block reads
+    void updateWindowEdges(int slot, int startSample, int endSample, bool firstPlayedOnly, bool reversed);
+    void buildWindowEdge(int slot, int edge, int partition, int cutStart, int cutEnd);
+    void transformCapturedPartition(int partition);
+    float* getSlotPartition(SpectrumPool& pool, int slot, int partition);
+    
+    //Edges are addressed as partitions maxPartitions and up, and stored first
+    static size_t getStoredIndex(int partition) { return (size_t) (partition >= maxPartitions ? partition - maxPartitions : partition + numEdgePartitions); }
+    
+    //Every pool that is allocated keeps the same capacity per stored slot, so any of them can be shaped into
+    void allocatePool(SpectrumPool& pool);
+    void allocateSlot(SpectrumPool& pool, int slot, int numPartitions);
+    void resizeStoredSlot(int slot, int numPartitions);
+    void writePartition(SpectrumPool& pool, int slot, int partition, const float* spectrum);
+    void readPartition(SpectrumPool& pool, int slot, int partition, float* spectrum);
+    
+    //Stores into the source pool, whoever stores a partition shapes it into the active pool afterwards
+    void storePartition(int slot, int partition, float* spectrum);
+    
+    //Partitions first to last of a slot from the source pool, those from numPartitions on count as silent
+    //Each needs its neighbours' samples, so a partition is only final once the next one is stored
+    //scratch is shapingScratchSize floats, one per thread that shapes
+    //Three FFTs per partition, and two more to design each filter when it's damped, one less from samples, the slot's
+    //samples in partition order, where the caller has them, otherwise the neighbours are transformed back from the source pool
+    void shapePartitions(SpectrumPool& pool, int slot, int first, int last, int numPartitions, float* scratch,
+                         std::span<const float> samples = {});
+    void designShapingFilter(const SpectrumPool& pool, int slot, int partition, float* filter);
+    int getShapingScratchSize() const { return fftSize * 6; }
+    void computeShapingCurves(SpectrumPool& pool) const;
+    bool isShapingFlat() const;
+    void requestShapingUpdate();
+    void waitForPoolUsers() const;
+    
+    //Capture partitions whose next partition is stored, or all of them once it has ended
+    int getNumFinalCapturePartitions() const;
+    bool shapeCapture();
+    
+    //Bytes prepare() allocates for the spectra, input history and capture at the block size being prepared
+    size_t getPlannedBytes(SpectrumStorage plannedStorage, int capacity, int historyLength) const;
+    int getHistoryLength(int capacity, int maxWindowLength) const;
+    
+    //Counted from the vectors themselves, under shapingLock and irDataLock respectively
+    size_t countBufferBytes() const;
+    size_t countIRDataBytes() const;
+    void account(std::atomic<size_t>& share, size_t bytes);
     void resizeMatrix(std::vector<std::vector<float>>& matrix, size_t outside, size_t inside);
     
     //Convolution Functions -- Called by processBlock
+    void processSegment(std::span<float> buffer, const WindowParameters& parameters);
+    
+    //Grid engines cut the window of both slots out, what's left for the MAC pass is all of it, played forwards
+    WindowParameters cutGridWindows(const WindowParameters& parameters);
+    
+    //Picks the partitions and weights the MAC pass plays, false when neither slot has anything to play
+    //Callers count as pool users, after the grid windows have been cut
+    bool selectWindow(const WindowParameters& parameters, bool firstPlayedOnly);
+    
+    //The overlap and history output of the last block feedHistory() took in
+    void restoreOverlap();
+    void convolveBlock(std::span<float> buffer, float mixAmt);
+    void convolvePartialBlock(std::span<float> buffer, float mixAmt);
     void addNewInputFFT(std::span<float> newFFT);
-    void multiplyFFTs(const std::span<float> input, const std::span<float> irFFT, std::span<float> output);
-    void convolveWithWindow(int startIndex, int endIndex);
+    //conjugate multiplies with the conjugated IR spectrum, used to play the window reversed
+    template <bool conjugate>
+    void multiplyAccumulate(const float* input, const float* irFFT, float weight, float* output, int numValues);
+    template <bool conjugate>
+    void multiplyAccumulateMorph(const float* input, const float* irA, float weightA,
+                                 const float* irB, float weightB, float* output, int numValues);
+    template <bool conjugate>
+    void multiplyAccumulateCompact(const float* input, int slotA, int partitionA, float weightA,
+                                   int slotB, int partitionB, float weightB, float* output);
+    void widenCompactBlock(const SpectrumPool& pool, int slot, int partition, int block, float weight, float* dest, bool accumulate) const;
+    void setWindow(int slotA, int startA, int lengthA, float weightA,
+                   int slotB, int startB, int lengthB, float weightB, bool reversed);
+    void convolveWithWindow(int first); //Sums partitions first to the end of the window into windowedFFT
+    template <bool reversed>
+    void accumulateWindow(int first, int last, float* output);
+    void applyReversePhase();
+    static void runWindowChunk(void* context, int chunk);
     
 
     //FFT Object
     std::unique_ptr<juce::dsp::FFT> fft;
     
-    int bufferSize;
-    int fftSize;
-    int fftOrder;
+    int bufferSize = 0;
+    int partitionsPerSlot = maxPartitions;
+    int fftSize = 0;
+    int fftOrder = 0;
+    
+    //Only bins 0 to fftSize/2 are stored, the inverse transform mirrors the rest
+    int spectrumSize = 0;
+    
+    //Output gain is normalised against the IR length, so it doesn't depend on the partition size
+    //At gainReferenceSize it matches the old 1/numPartitions scaling
+    static constexpr int gainReferenceSize = 512;
+    
+    std::array<std::vector<float>, numSlots> irData; //IR Raw Data
+    juce::CriticalSection irDataLock; //Only taken off the realtime thread, by loads and grid windows
+    
+    int windowGrid = 0;
+    std::array<GridWindow, numSlots> gridWindows;
+    WindowParameters gridBlockParameters; //What the block playing now was started with, its window is cut from these
+    std::array<std::atomic<juce::uint32>, numSlots> irVersions {};
     
-    int numPartitions = 0;
+    //Grid windows are written in place, on the thread that plays them, and captures into the spare,
+    //which is kept at the full partition capacity for them, as the audio thread can't allocate
+    //A capture only claims it for as long as it takes to swap it in, and only while it's reserved
+    enum class SpareUse { none, load, capture };
+    std::array<IRSlot, numStoredSlots> slots;
+    std::array<std::atomic<int>, numSlots> storedSlots {0, 1, 2, 3};
+    std::atomic<SpareUse> spareUse {SpareUse::none};
+    std::atomic<bool> isSpareReserved {false};
     
-    bool IRloaded = false;
+#if DYNCONV_COMPACT_IR_SPECTRA
+    SpectrumStorage preferredStorage = SpectrumStorage::compact;
+#else
+    SpectrumStorage preferredStorage = SpectrumStorage::full;
+#endif
+    SpectrumStorage storage = preferredStorage; //What prepare() could fit in the budget
     
+    //Window length asked for and the one prepare() could fit, in samples, 0 for the whole slot
+    int requestedWindowLength = 0;
+    int windowLimit = 0;
     
-    std::vector<float> irData; //IR Raw Data
-    std::vector<std::vector<float>> IRffts;//IR FFT Results / Convolution Buffer
+    //This engine's share of the budget, everything prepare() and updateShaping() allocate, and the IR data
+    MemoryBudget* memoryBudget = nullptr;
+    std::atomic<size_t> bufferBytes {0};
+    std::atomic<size_t> irDataBytes {0};
+    
+    //Compact storage, each partition is padded to whole blocks of compactBlockSize values
+    static constexpr int compactBlockSize = 32;
+    int numCompactBlocks = 0;
+    
+    //Every slot keeps room for its window edges, whatever it holds
+    static constexpr int numEdgePartitions = 2;
+    
+    //Spectra as built from the IRs, and two shaped copies, one played while the other is rebuilt
+    //The MAC pass reads whichever is active, the source itself while the shaping is flat
+    SpectrumPool sourcePool;
+    std::array<SpectrumPool, 2> shapedPools;
+    std::atomic<SpectrumPool*> activePool {&sourcePool};
+    SpectrumPool* blockPool = &sourcePool; //Active pool of the current block
+    std::atomic<juce::uint32> poolSwaps {0}; //Counted after every swap, the edges are rebuilt on the next block
+    juce::uint32 blockPoolSwaps = 0;
+    std::atomic<int> poolUsers {0};
+    
+    //Bumped by anything the shaped spectra depend on, writes count the source partitions stored
+    std::atomic<juce::uint32> shapingVersion {1};
+    std::atomic<juce::uint32> sourceWrites {0};
+    juce::uint32 shapedVersion = 0;
+    //Held by updateShaping(), prepare() and loads, never on the audio thread, always taken after irDataLock
+    juce::CriticalSection shapingLock;
+    std::vector<float> shapingScratch;
+    std::vector<float> liveShapingScratch; //Grid windows, shaped on the thread that plays them
+    std::atomic<SpectrumShaper*> shaper {nullptr};
+    double sampleRate = 44100.0; //Under shapingLock, the audio thread reads the rate a pool was shaped at
+    
+    static constexpr float minLowCutHz = 20.0f;
+    static constexpr float maxHighCutHz = 20000.0f;
+    static constexpr float tiltPivotHz = 1000.0f;
+    static constexpr float maxDampingDbPerSecond = 60.0f; //At Nyquist with damping at 1
     
     //Basic fftBuffer to hold outputs, especially in createWindowedFFT()
     std::vector<float> fftBuffer;
+    std::vector<float> irScratch; //FFT scratch used while building slot spectra
 
     std::vector<float> windowedFFT;//stores summed FFT output after convolution
     
+    //Window edges, the key an edge was built for, and the partitions the edges stand in for this block (-1 for none)
+    struct WindowEdge
+    {
+        int partition = -1;
+        int cutStart = 0;
+        int cutEnd = 0;
+        juce::uint32 poolSwaps = 0;
+        juce::uint32 sourceWrites = 0;
+    };
+    
+    std::array<std::array<WindowEdge, numEdgePartitions>, numStoredSlots> windowEdges;
+    std::array<std::array<int, numEdgePartitions>, numStoredSlots> activeEdges;
+    std::vector<float> edgeScratch;
+    
+    //e^(-2*pi*i*k*(bufferSize-1)/fftSize) per bin, turns a conjugated partition into the reversed one
+    std::vector<float> reversePhase;
+    
     int inputFftIndex = 0;
-    std::vector<std::vector<float>> inputFFTbuffer;//Stores FFT result from new block input
+    std::vector<std::vector<float>> inputFFTbuffer;//Stores FFT result from new block input, as many as the longest window
     
     std::vector<float> overlapBuffer; //Stores overlaping convolution data
     
+    //Block filled by calls shorter than a block, the partitions after the first only hear finished blocks,
+    //so their output is summed once when the block starts and only the first partition is convolved again on each call
+    std::vector<float> blockInput;
+    std::vector<float> historyOutput;
+    int blockFill = 0;
+    
+    //Set by feedHistory(), audio thread only
+    WindowParameters fedParameters;
+    bool isOverlapPending = false;
+    
+    //Capture, room for a full slot is allocated in prepare(), and its spectra are the reserved spare
+    std::vector<float> captureBuffer;
+    std::vector<float> captureScratch;
+    int captureLength = 0;
+    std::atomic<int> captureSlot {-1};
+    int capturedSlot = 0;
+    std::atomic<bool> captureCommitPending {false};
+    
+    //Stored slot of a capture until it's committed, and how far the active pool has it shaped
+    std::atomic<int> captureStored {-1};
+    std::atomic<int> shapedCapturePartitions {0};
+    std::atomic<juce::uint32> captureWrites {0};
+    
     
     //Parameters
     std::atomic<float> filePosition{0.0};
     std::atomic<float> fileLength{1.0};
     std::atomic<float> dryWet{0.5};
     
+    std::atomic<int> slotA{0};
+    std::atomic<int> slotB{1};
+    std::atomic<float> morph{0.0};
+    std::atomic<bool> reverse{false};
+    
+    std::atomic<float> lowCut{minLowCutHz};
+    std::atomic<float> highCut{maxHighCutHz};
+    std::atomic<float> tilt{0.0};
+    std::atomic<float> damping{0.0};
+    
     std::atomic<bool> newParams = false;
 
-    juce::AudioProcessorValueTreeState& valueTreeState;
-};
+    juce::AudioProcessorValueTreeState* valueTreeState = nullptr;
+    
+    //Window of the current block, read by the chunks while they run
+    struct WindowState
+    {
+        int slotA = 0, startA = 0, lengthA = 0;
+        int slotB = 0, startB = 0, lengthB = 0;
+        float weightA = 0.0f, weightB = 0.0f;
+        bool reversed = false;
+        int first = 0;
+        int length = 0;
+        int chunkLength = 0;
+    };
+    
+    //Chunks are only worth handing out once each has a few partitions to chew on
+    static constexpr int maxChunks = 16;
+    static constexpr int minPartitionsPerChunk = 8;
+    
+    DSPScheduler* scheduler = nullptr;
+    WindowState window;
+    std::vector<std::vector<float>> partialSums; //One spectrum per chunk, summed into windowedFFT afterwards
+    DSPJobGroup jobGroup {&DynamicConvolverV2::runWindowChunk, this};
+};
\ No newline at end of file
@@ -7,37 +7,106 @@
 
 #include "Graphics.h"
 
+juce::Image createWaveformImage(const PeakPyramid& peaks, int width, int height,
+                                juce::Colour background, juce::Colour waveform)
+{
+    juce::Image image(juce::Image::RGB, juce::jmax(1, width), juce::jmax(1, height), false);
+    juce::Graphics g(image);
+    g.fillAll(background);
+    
+    if(peaks.numChannels == 0 || width <= 0 || height <= 0)
+        return image;
+    
+    g.setColour(waveform);
+    
+    auto samplesPerPixel = static_cast<double>(peaks.numSamples) / width;
+    auto level = peaks.chooseLevel(samplesPerPixel);
+    auto laneHeight = static_cast<float>(height) / peaks.numChannels;
+    
+    //One vertical line per pixel column and channel, read from the matching pyramid level
+    for(auto ch = 0; ch < peaks.numChannels; ++ch)
+    {
+        auto laneCentre = laneHeight * (ch + 0.5f);
+        
+        for(auto x = 0; x < width; ++x)
+        {
+            auto start = static_cast<juce::int64>(x * samplesPerPixel);
+            auto end = static_cast<juce::int64>((x + 1) * samplesPerPixel);
+            auto peak = peaks.getPeak(level, ch, start, end);
+            
+            auto top = laneCentre - peak.getEnd() * laneHeight * 0.5f;
+            auto bottom = laneCentre - peak.getStart() * laneHeight * 0.5f;
+            g.drawVerticalLine(x, top, juce::jmax(bottom, top + 1.0f));
+        }
+    }
+    
+    return image;
+}
+
 FileHighlight::FileHighlight(juce::AudioProcessorValueTreeState& vts) : valueTreeState(vts){
+    filePos.store(valueTreeState.getRawParameterValue("FILE_POS")->load());
+    fileLen.store(valueTreeState.getRawParameterValue("FILE_LEN")->load());
+    
     valueTreeState.addParameterListener("FILE_POS", this);
     valueTreeState.addParameterListener("FILE_LEN", this);
-    startTimerHz(60);
+    setInterceptsMouseClicks(false, false);
 };
 
 FileHighlight::~FileHighlight()
 {
     valueTreeState.removeParameterListener("FILE_POS", this);
     valueTreeState.removeParameterListener("FILE_LEN", this);
+    cancelPendingUpdate();
 }
 
 void FileHighlight::paint(juce::Graphics& g)
 {
     g.setColour(juce::Colours::whitesmoke.withAlpha(0.5f));
-    
+    g.fillRect(highlightBounds);
+}
+
+void FileHighlight::resized()
+{
+    highlightBounds = getHighlightBounds();
+    repaint();
+}
+
+juce::Rectangle<int> FileHighlight::getHighlightBounds() const
+{
     int newX = getWidth() * filePos.load();
     int newWidth = getWidth() * fileLen.load();
     
-    g.fillRect(newX, 0, newWidth, getHeight());
+    return juce::Rectangle<int>(newX, 0, newWidth, getHeight()).getIntersection(getLocalBounds());
 }
 
 void FileHighlight::parameterChanged(const juce::String& parameterID, float newValue)
 {
+    //Can be called from the audio thread, so only store and defer the repaint
     if(parameterID == "FILE_POS")
         filePos.store(newValue);
     else if (parameterID == "FILE_LEN")
         fileLen.store(newValue);
+    
+    triggerAsyncUpdate();
 }
 
-void FileHighlight::timerCallback()
+void FileHighlight::handleAsyncUpdate()
 {
-    repaint();
+    auto newBounds = getHighlightBounds();
+    
+    if(newBounds == highlightBounds)
+        return;
+    
+    //Only the edges that moved need redrawing
+    juce::RectangleList<int> dirty(highlightBounds);
+    dirty.add(newBounds);
+    
+    auto unchanged = highlightBounds.getIntersection(newBounds);
+    if(!unchanged.isEmpty())
+        dirty.subtract(unchanged);
+    
+    highlightBounds = newBounds;
+    
+    for(auto& area : dirty)
+        repaint(area);
 }
@@ -13,21 +13,33 @@
 #include <juce_audio_processors/juce_audio_processors.h>
 #include <juce_graphics/juce_graphics.h>
 
-class FileHighlight : public juce::Component, juce::AudioProcessorValueTreeState::Listener, juce::Timer
+#include "IRFileLoader.h"
+
+//Renders the IR waveform from its peak pyramid, the editor caches the result
+juce::Image createWaveformImage(const PeakPyramid& peaks, int width, int height,
+                                juce::Colour background, juce::Colour waveform);
+
+class FileHighlight : public juce::Component, juce::AudioProcessorValueTreeState::Listener, juce::AsyncUpdater
 {
 public:
     FileHighlight(juce::AudioProcessorValueTreeState& vts);
     ~FileHighlight() override;
     
     void paint(juce::Graphics& g) override;
+    void resized() override;
     void parameterChanged(const juce::String& parameterID, float newValue) override;
-    void timerCallback() override;
+    void handleAsyncUpdate() override;
     
 private:
+    juce::Rectangle<int> getHighlightBounds() const;
+    
     juce::AudioProcessorValueTreeState& valueTreeState;
     
     std::atomic<float> filePos{0.0};
     std::atomic<float> fileLen{1.0};
+    
+    //Last painted region, only the difference is repainted when parameters move
+    juce::Rectangle<int> highlightBounds;
 };
 
 #endif /* Graphics_hpp */
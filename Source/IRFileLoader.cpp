@@ -0,0 +1,193 @@
+/*
+  ==============================================================================
+
+    IRFileLoader.cpp
+    Created: 19 Oct 2026 10:12:31am
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#include "IRFileLoader.h"
+#include "Trace.h"
+
+
+
+void PeakPyramid::build(const juce::AudioBuffer<float>& source)
+{
+    numChannels = source.getNumChannels();
+    numSamples = source.getNumSamples();
+    levels.clear();
+
+    if (numChannels == 0 || numSamples == 0)
+        return;
+
+    //First level is read straight from the samples
+    auto numBins = static_cast<int>((numSamples + baseBinSize - 1) / baseBinSize);
+    auto& base = levels.emplace_back(static_cast<size_t>(numChannels));
+
+    for(auto ch = 0; ch < numChannels; ++ch)
+    {
+        auto* data = source.getReadPointer(ch);
+        base[ch].resize(static_cast<size_t>(numBins));
+
+        for(auto bin = 0; bin < numBins; ++bin)
+        {
+            auto start = bin * baseBinSize;
+            auto num = std::min(baseBinSize, static_cast<int>(numSamples) - start);
+            base[ch][bin] = juce::FloatVectorOperations::findMinAndMax(data + start, num);
+        }
+    }
+
+    //Every following level merges pairs of bins from the one before
+    while(numBins > 1)
+    {
+        numBins = (numBins + 1) / 2;
+        auto& previous = levels.back();
+        std::vector<std::vector<juce::Range<float>>> next(static_cast<size_t>(numChannels));
+
+        for(auto ch = 0; ch < numChannels; ++ch)
+        {
+            next[ch].resize(static_cast<size_t>(numBins));
+            for(auto bin = 0; bin < numBins; ++bin)
+            {
+                auto first = static_cast<size_t>(bin * 2);
+                auto range = previous[ch][first];
+                if(first + 1 < previous[ch].size())
+                    range = range.getUnionWith(previous[ch][first + 1]);
+                next[ch][bin] = range;
+            }
+        }
+
+        levels.push_back(std::move(next));
+    }
+}
+
+int PeakPyramid::chooseLevel(double samplesPerPixel) const
+{
+    auto level = 0;
+    while(level + 1 < static_cast<int>(levels.size()) && getBinSize(level + 1) <= samplesPerPixel)
+        ++level;
+
+    return level;
+}
+
+juce::Range<float> PeakPyramid::getPeak(int level, int channel, juce::int64 startSample, juce::int64 endSample) const
+{
+    auto& bins = levels[level][channel];
+    auto binSize = getBinSize(level);
+
+    auto first = juce::jlimit<juce::int64>(0, (juce::int64) bins.size() - 1, startSample / binSize);
+    auto last = juce::jlimit<juce::int64>(first + 1, (juce::int64) bins.size(), (endSample + binSize - 1) / binSize);
+
+    auto range = bins[first];
+    for(auto bin = first + 1; bin < last; ++bin)
+        range = range.getUnionWith(bins[bin]);
+
+    return range;
+}
+
+//==============================================================================
+IRFileLoader::IRFileLoader(int numSlots) : juce::Thread("IR File Loader"),
+    pendingFiles(static_cast<size_t>(numSlots)), loadedIRs(static_cast<size_t>(numSlots))
+{
+    formatManager.registerBasicFormats();
+    startThread();
+}
+
+IRFileLoader::~IRFileLoader()
+{
+    removeAllChangeListeners();
+    signalThreadShouldExit();
+    notify();
+    stopThread(4000);
+}
+
+void IRFileLoader::loadAsync(const juce::File& file, int slot)
+{
+    if(!juce::isPositiveAndBelow(slot, static_cast<int>(pendingFiles.size())))
+        return;
+    
+    {
+        const juce::ScopedLock sl(lock);
+        pendingFiles[slot] = file;
+    }
+    notify();
+}
+
+std::shared_ptr<const LoadedIR> IRFileLoader::getLoadedIR(int slot) const
+{
+    const juce::ScopedLock sl(lock);
+    return juce::isPositiveAndBelow(slot, static_cast<int>(loadedIRs.size())) ? loadedIRs[slot] : nullptr;
+}
+
+std::shared_ptr<LoadedIR> IRFileLoader::decodeFile(juce::AudioFormatManager& manager, const juce::File& file)
+{
+    DYNCONV_TRACE_SCOPE("IR decode");
+    
+    std::unique_ptr<juce::AudioFormatReader> reader(manager.createReaderFor(file));
+
+    if(reader == nullptr)
+    {
+        juce::Logger::writeToLog("Error: IR failed to load...\n");
+        return nullptr;
+    }
+
+    auto newIR = std::make_shared<LoadedIR>();
+    newIR->file = file;
+    newIR->sampleRate = reader->sampleRate;
+
+    auto numSamples = static_cast<int>(reader->lengthInSamples);
+    newIR->buffer.setSize(static_cast<int>(reader->numChannels), numSamples);
+    reader->read(&newIR->buffer, 0, numSamples, 0, true, true);
+
+    //Normalise so that every IR hits the engine at the same peak level
+    auto mag = newIR->buffer.getMagnitude(0, numSamples);
+    if(mag > 0.0f)
+        newIR->buffer.applyGain(0, numSamples, 1.0f / mag);
+
+    newIR->peaks.build(newIR->buffer);
+    return newIR;
+}
+
+void IRFileLoader::run()
+{
+    DYNCONV_TRACE_REGISTER_THREAD();
+
+    while(!threadShouldExit())
+    {
+        wait(-1);
+
+        for(size_t slot = 0; slot < pendingFiles.size() && !threadShouldExit(); ++slot)
+        {
+            juce::File file;
+            {
+                const juce::ScopedLock sl(lock);
+                std::swap(file, pendingFiles[slot]);
+            }
+
+            if(file == juce::File{})
+                continue;
+
+            auto newIR = decodeFile(formatManager, file);
+
+            if(newIR == nullptr || threadShouldExit())
+                continue;
+
+            {
+                const juce::ScopedLock sl(lock);
+
+                //A newer request for this slot arrived while decoding, skip straight to it
+                if(pendingFiles[slot] != juce::File{})
+                {
+                    notify();
+                    continue;
+                }
+
+                loadedIRs[slot] = std::move(newIR);
+            }
+
+            sendChangeMessage();
+        }
+    }
+}
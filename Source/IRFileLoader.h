@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+
+    IRFileLoader.h
+    Created: 19 Oct 2026 10:12:31am
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <juce_core/juce_core.h>
+#include <juce_events/juce_events.h>
+
+#include <memory>
+#include <vector>
+
+
+//Min/Max peak pyramid of a decoded IR, used to draw the waveform display
+//Level 0 holds one min/max pair per baseBinSize samples, every following
+//level halves the resolution of the previous one
+struct PeakPyramid
+{
+    static constexpr int baseBinSize = 32;
+
+    void build(const juce::AudioBuffer<float>& source);
+
+    //Picks the coarsest level that still has at least one bin per pixel
+    int chooseLevel(double samplesPerPixel) const;
+    int getBinSize(int level) const { return baseBinSize << level; }
+
+    //Min/Max over a range of samples, read from the given level
+    juce::Range<float> getPeak(int level, int channel, juce::int64 startSample, juce::int64 endSample) const;
+
+    int numChannels = 0;
+    juce::int64 numSamples = 0;
+
+    //levels[level][channel][bin]
+    std::vector<std::vector<std::vector<juce::Range<float>>>> levels;
+};
+
+
+//Result of a single decode, shared by the convolution engine and the editor
+struct LoadedIR
+{
+    juce::File file;
+    double sampleRate = 0.0;
+
+    juce::AudioBuffer<float> buffer; //Normalised IR samples
+    PeakPyramid peaks;
+};
+
+
+//Decodes IR files on a background thread, one decoded IR per slot
+//Listeners are notified on the message thread once a new IR is ready
+class IRFileLoader : public juce::ChangeBroadcaster,
+                     private juce::Thread
+{
+public:
+    IRFileLoader(int numSlots);
+    ~IRFileLoader() override;
+
+    void loadAsync(const juce::File& file, int slot);
+    std::shared_ptr<const LoadedIR> getLoadedIR(int slot) const;
+
+    //Synchronous decode, also used by the offline tools
+    static std::shared_ptr<LoadedIR> decodeFile(juce::AudioFormatManager& manager, const juce::File& file);
+
+private:
+    void run() override;
+
+    juce::AudioFormatManager formatManager;
+
+    mutable juce::CriticalSection lock;
+    std::vector<juce::File> pendingFiles;
+    std::vector<std::shared_ptr<const LoadedIR>> loadedIRs;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (IRFileLoader)
+};
@@ -0,0 +1,61 @@
+/*
+  ==============================================================================
+
+    MemoryBudget.cpp
+    Created: 20 Oct 2026 4:52:08pm
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#include "MemoryBudget.h"
+
+//Set by the CMake build, in megabytes, the same default for builds that don't
+#ifndef DYNCONV_MEMORY_BUDGET_MB
+ #define DYNCONV_MEMORY_BUDGET_MB 1024
+#endif
+
+
+
+MemoryBudget::MemoryBudget()
+    : limit(static_cast<size_t>(DYNCONV_MEMORY_BUDGET_MB) * 1024 * 1024)
+{
+}
+
+void MemoryBudget::setLimit(size_t newLimitBytes)
+{
+    limit.store(newLimitBytes);
+}
+
+size_t MemoryBudget::getLimit() const
+{
+    return limit.load();
+}
+
+size_t MemoryBudget::getUsedBytes() const
+{
+    return used.load();
+}
+
+bool MemoryBudget::tryResize(size_t oldBytes, size_t newBytes)
+{
+    auto current = used.load();
+
+    for(;;)
+    {
+        //Shrinking always fits, even when the total is already over a lowered limit
+        auto next = current - oldBytes + newBytes;
+        auto maxBytes = limit.load();
+
+        if(newBytes > oldBytes && maxBytes > 0 && next > maxBytes)
+            return false;
+
+        if(used.compare_exchange_weak(current, next))
+            return true;
+    }
+}
+
+void MemoryBudget::resize(size_t oldBytes, size_t newBytes)
+{
+    used.fetch_add(newBytes - oldBytes);
+}
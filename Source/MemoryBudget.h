@@ -0,0 +1,41 @@
+/*
+  ==============================================================================
+
+    MemoryBudget.h
+    Created: 20 Oct 2026 4:52:08pm
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <atomic>
+
+
+//Bytes held by every engine that shares it, usually one per process
+//Engines check it when they're prepared and pick a smaller layout if theirs won't fit
+class MemoryBudget
+{
+public:
+    MemoryBudget();
+
+    //0 for no limit, engines that are already prepared keep what they hold
+    void setLimit(size_t newLimitBytes);
+    size_t getLimit() const;
+    size_t getUsedBytes() const;
+
+    //Swaps a share of oldBytes for one of newBytes, fails if that would grow the total past the limit
+    bool tryResize(size_t oldBytes, size_t newBytes);
+
+    //Same, but always goes through, for memory that has been allocated already
+    void resize(size_t oldBytes, size_t newBytes);
+
+private:
+    std::atomic<size_t> limit {0};
+    std::atomic<size_t> used {0};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MemoryBudget)
+};
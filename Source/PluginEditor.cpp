@@ -8,11 +8,11 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "Trace.h"
 
 //==============================================================================
 Dynamic_ConvolverAudioProcessorEditor::Dynamic_ConvolverAudioProcessorEditor (Dynamic_ConvolverAudioProcessor& p, juce::AudioProcessorValueTreeState& vts)
-    : AudioProcessorEditor (&p), audioProcessor (p), valueTreeState(vts),
-    thumbnailCache(5), thumbnail(512, formatManager, thumbnailCache)
+    : AudioProcessorEditor (&p), audioProcessor (p), valueTreeState(vts)
 {
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
@@ -21,6 +21,19 @@ Dynamic_ConvolverAudioProcessorEditor::Dynamic_ConvolverAudioProcessorEditor (Dy
     openButton.setButtonText("Open");
     openButton.onClick = [this] {openButtonClicked();};
     
+    //Plays the selected window backwards, straight from the stored spectra
+    addAndMakeVisible(&reverseButton);
+    reverseButton.setButtonText("Reverse");
+    reverseButton.setClickingTogglesState(true);
+    reverseButton.onClick = [this] {reverseButtonClicked();};
+    reverseAttch.reset(new juce::AudioProcessorValueTreeState::ButtonAttachment(valueTreeState, "REVERSE", reverseButton));
+    
+    //Records the sidechain into slot A while it's held on
+    addAndMakeVisible(&captureButton);
+    captureButton.setButtonText("Capture");
+    captureButton.setClickingTogglesState(true);
+    captureAttch.reset(new juce::AudioProcessorValueTreeState::ButtonAttachment(valueTreeState, "CAPTURE", captureButton));
+    
     filePosAttch.reset(new juce::AudioProcessorValueTreeState::SliderAttachment (valueTreeState, "FILE_POS", filePosSlider));
     filePosSlider.setSliderStyle(juce::Slider::RotaryVerticalDrag);
     filePosSlider.setTextBoxStyle(juce::Slider::TextBoxBelow, false, 60, 20);
@@ -49,18 +62,63 @@ Dynamic_ConvolverAudioProcessorEditor::Dynamic_ConvolverAudioProcessorEditor (Dy
     addAndMakeVisible(&dryWetSlider);
     addAndMakeVisible(&dwLabel);
     
-    formatManager.registerBasicFormats();
-    thumbnail.addChangeListener(this);
+    //IR Slots, Open loads into the slot shown in the display
+    for(auto slot = 1; slot <= DynamicConvolverV2::numSlots; ++slot)
+    {
+        loadSlotBox.addItem("Slot " + juce::String(slot), slot);
+        slotABox.addItem("A: Slot " + juce::String(slot), slot);
+        slotBBox.addItem("B: Slot " + juce::String(slot), slot);
+    }
+    
+    loadSlotBox.setSelectedId(1, juce::dontSendNotification);
+    loadSlotBox.onChange = [this] {displayedSlotChanged();};
+    addAndMakeVisible(&loadSlotBox);
+    
+    slotAAttch.reset(new juce::AudioProcessorValueTreeState::ComboBoxAttachment(valueTreeState, "SLOT_A", slotABox));
+    slotBAttch.reset(new juce::AudioProcessorValueTreeState::ComboBoxAttachment(valueTreeState, "SLOT_B", slotBBox));
+    addAndMakeVisible(&slotABox);
+    addAndMakeVisible(&slotBBox);
+    
+    morphAttch.reset(new juce::AudioProcessorValueTreeState::SliderAttachment(valueTreeState, "MORPH", morphSlider));
+    morphSlider.setSliderStyle(juce::Slider::LinearHorizontal);
+    morphSlider.setTextBoxStyle(juce::Slider::TextBoxRight, false, 50, 20);
+    addAndMakeVisible(&morphSlider);
+    
+    //Tone of the IR, applied to its stored spectra
+    const char* shapingIDs[numShapingKnobs] = {"LOW_CUT", "HIGH_CUT", "TILT", "DAMPING"};
+    const char* shapingNames[numShapingKnobs] = {"Low Cut", "High Cut", "Tilt", "Damping"};
+    
+    for(auto i = 0; i < numShapingKnobs; ++i)
+    {
+        shapingAttchs[i].reset(new juce::AudioProcessorValueTreeState::SliderAttachment(valueTreeState, shapingIDs[i], shapingSliders[i]));
+        shapingSliders[i].setSliderStyle(juce::Slider::RotaryVerticalDrag);
+        shapingSliders[i].setTextBoxStyle(juce::Slider::TextBoxBelow, false, 60, 16);
+        shapingLabels[i].setText(shapingNames[i], juce::dontSendNotification);
+        shapingLabels[i].setJustificationType(juce::Justification::centred);
+        addAndMakeVisible(&shapingSliders[i]);
+        addAndMakeVisible(&shapingLabels[i]);
+    }
+    
+   #if DYNCONV_TRACE
+    addAndMakeVisible(&saveTraceButton);
+    saveTraceButton.setButtonText("Save Trace");
+    saveTraceButton.onClick = [this] {saveTraceButtonClicked();};
+   #endif
+    
+    audioProcessor.d2_conv->addChangeListener(this);
+    displayedIR = audioProcessor.d2_conv->getSlotIR(getDisplayedSlot());
+    displayedDroppedSamples = audioProcessor.d2_conv->getNumDroppedSamples(getDisplayedSlot());
     
     fileHighlight = std::make_unique<FileHighlight>(valueTreeState);
     addAndMakeVisible(*fileHighlight);
     
     
-    setSize (400, 470);
+    setSize (400, 600);
 }
 
 Dynamic_ConvolverAudioProcessorEditor::~Dynamic_ConvolverAudioProcessorEditor()
 {
+    audioProcessor.d2_conv->removeChangeListener(this);
 }
 
 //==============================================================================
@@ -75,17 +133,39 @@ void Dynamic_ConvolverAudioProcessorEditor::resized()
     auto knobWidth = 100;
     auto knobHeight = 100;
     auto labelHeight = 50;
-    auto knobY = height - (knobHeight + labelHeight);
-    auto labelY = height - labelHeight;
+    auto slotRowHeight = 40;
+    auto knobY = height - (knobHeight + labelHeight + slotRowHeight);
+    auto labelY = height - (labelHeight + slotRowHeight);
     
     auto knobPadding = 10;
     auto knobsX = width/numKnobs  - knobWidth - knobPadding/numKnobs;
     
-    juce::Rectangle<int> thumbnailBounds (20, 20, width-40, height-230);
+    auto thumbnailBounds = getThumbnailBounds();
     
     fileHighlight->setBounds(thumbnailBounds);
+    irChanged();
+    
+    openButton.setBounds(20, getHeight()-320, getWidth()-330, 20);
+    reverseButton.setBounds(getWidth()-300, getHeight()-320, 80, 20);
+    captureButton.setBounds(getWidth()-210, getHeight()-320, 80, 20);
     
-    openButton.setBounds(20, getHeight()-190, getWidth()-40, 20);
+   #if DYNCONV_TRACE
+    saveTraceButton.setBounds(getWidth()-100, 0, 80, 18);
+   #endif
+    loadSlotBox.setBounds(getWidth()-120, getHeight()-320, 100, 20);
+    
+    //Shaping row, between the buttons and the main knobs
+    auto shapingWidth = (width - 40) / numShapingKnobs;
+    for(auto i = 0; i < numShapingKnobs; ++i)
+    {
+        shapingLabels[i].setBounds(20 + i * shapingWidth, height - 292, shapingWidth, 16);
+        shapingSliders[i].setBounds(25 + i * shapingWidth, height - 276, shapingWidth - 10, 80);
+    }
+    
+    auto slotRowY = height - slotRowHeight + 5;
+    slotABox.setBounds(20, slotRowY, 90, 20);
+    morphSlider.setBounds(120, slotRowY, width - 240, 20);
+    slotBBox.setBounds(width - 110, slotRowY, 90, 20);
     
     
     filePosSlider.setBounds(knobsX, knobY, knobWidth, knobHeight);
@@ -102,9 +182,9 @@ void Dynamic_ConvolverAudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-    juce::Rectangle<int> thumbnailBounds (20, 20, getWidth()-40, getHeight()-230);
+    auto thumbnailBounds = getThumbnailBounds();
     
-    if(thumbnail.getNumChannels() == 0)
+    if(displayedIR == nullptr)
     {
         paintIfNoFileLoaded(g, thumbnailBounds);
     }else
@@ -123,27 +203,77 @@ void Dynamic_ConvolverAudioProcessorEditor::paintIfNoFileLoaded(juce::Graphics&
 
 void Dynamic_ConvolverAudioProcessorEditor::paintIfFileLoaded(juce::Graphics &g, const juce::Rectangle<int> bounds)
 {
-    g.setColour(juce::Colours::darkcyan);
-    g.fillRect(bounds);
-    g.setColour(juce::Colours::whitesmoke);
+    g.drawImageAt(waveformImage, bounds.getX(), bounds.getY());
+    
+    if(reverseButton.getToggleState())
+    {
+        g.setColour(juce::Colours::white);
+        g.drawFittedText("Reversed", bounds.reduced(6), juce::Justification::topRight, 1);
+    }
     
-    thumbnail.drawChannels(g, bounds, 0.0f, thumbnail.getTotalLength(), 1.0f);
+    //The engines hold a limited number of partitions, fewer when the memory budget is tight
+    auto numDropped = displayedDroppedSamples;
+    auto numSamples = displayedIR->buffer.getNumSamples();
+    
+    if(numDropped > 0 && displayedIR->sampleRate > 0.0)
+    {
+        g.setColour(juce::Colours::orange);
+        g.drawFittedText("Cut to " + juce::String((numSamples - numDropped) / displayedIR->sampleRate, 2) + " s",
+                         bounds.reduced(6), juce::Justification::topLeft, 1);
+    }
 }
 
+juce::Rectangle<int> Dynamic_ConvolverAudioProcessorEditor::getThumbnailBounds() const
+{
+    return {20, 20, getWidth()-40, getHeight()-360};
+}
+
+int Dynamic_ConvolverAudioProcessorEditor::getDisplayedSlot() const
+{
+    return loadSlotBox.getSelectedId() - 1;
+}
+
+void Dynamic_ConvolverAudioProcessorEditor::displayedSlotChanged()
+{
+    displayedIR = audioProcessor.d2_conv->getSlotIR(getDisplayedSlot());
+    displayedDroppedSamples = audioProcessor.d2_conv->getNumDroppedSamples(getDisplayedSlot());
+    irChanged();
+}
 
 
 void Dynamic_ConvolverAudioProcessorEditor::changeListenerCallback(juce::ChangeBroadcaster *source)
 {
-    if(source == &thumbnail)
+    //Loads, committed captures and new engine layouts, the waveform is only drawn again for a new IR
+    if(source == audioProcessor.d2_conv.get())
     {
-        thumbnailChanged();
+        auto newIR = audioProcessor.d2_conv->getSlotIR(getDisplayedSlot());
+        displayedDroppedSamples = audioProcessor.d2_conv->getNumDroppedSamples(getDisplayedSlot());
+        
+        if(newIR != displayedIR)
+        {
+            displayedIR = newIR;
+            irChanged();
+        }
+        else
+        {
+            repaint(getThumbnailBounds());
+        }
     }
 }
 
 
-void Dynamic_ConvolverAudioProcessorEditor::thumbnailChanged()
+void Dynamic_ConvolverAudioProcessorEditor::irChanged()
 {
-        repaint();
+    auto bounds = getThumbnailBounds();
+    
+    //Re-render the cached waveform only when the IR or the display size changes
+    if(displayedIR != nullptr)
+        waveformImage = createWaveformImage(displayedIR->peaks, bounds.getWidth(), bounds.getHeight(),
+                                            juce::Colours::darkcyan, juce::Colours::whitesmoke);
+    else
+        waveformImage = {};
+    
+    repaint(bounds);
 }
 
 
@@ -159,17 +289,34 @@ void Dynamic_ConvolverAudioProcessorEditor::openButtonClicked()
         
         if(file != juce::File{})
         {
-            auto* reader = formatManager.createReaderFor(file);
-            
-            if(reader != nullptr)
-            {
-                auto newSource = std::make_unique<juce::AudioFormatReaderSource>(reader, true);
-                thumbnail.setSource(new juce::FileInputSource (file));
-            }
-//            audioProcessor.d_conv->loadNewIR(file);
-//            audioProcessor.e_conv->loadFileAsIR(file);
-            audioProcessor.d2_conv->loadFileAsIR(file);
+            //Decoded once on the loader thread, the editor is notified through changeListenerCallback
+            audioProcessor.d2_conv->loadFileAsIR(file, getDisplayedSlot());
         }
     }
     );
 }
+
+void Dynamic_ConvolverAudioProcessorEditor::reverseButtonClicked()
+{
+    //The engine reverses on its own through the REVERSE parameter, only the display needs updating
+    repaint(getThumbnailBounds());
+}
+
+#if DYNCONV_TRACE
+void Dynamic_ConvolverAudioProcessorEditor::saveTraceButtonClicked()
+{
+    fileChooser = std::make_unique<juce::FileChooser>("Save Trace", juce::File{}, "*.json");
+    
+    auto chooserFlags = juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::warnAboutOverwriting;
+    
+    fileChooser->launchAsync(chooserFlags, [] (const juce::FileChooser& fc)
+    {
+        auto file = fc.getResult();
+        
+        //Open in chrome://tracing or ui.perfetto.dev
+        if(file != juce::File{})
+            DynConvTrace::exportChromeTrace(file);
+    }
+    );
+}
+#endif
@@ -16,6 +16,8 @@
 #include <juce_graphics/juce_graphics.h>
 #include <juce_audio_utils/juce_audio_utils.h>
 
+#include <array>
+
 //==============================================================================
 /**
 */
@@ -32,12 +34,13 @@ public:
     
     void changeListenerCallback(juce::ChangeBroadcaster* source) override;
     
-    void thumbnailChanged();
+    void irChanged();
 
     void paintIfNoFileLoaded(juce::Graphics& g, const juce::Rectangle<int> bounds);
     void paintIfFileLoaded(juce::Graphics& g, const juce::Rectangle<int> bounds);
     
     void openButtonClicked();
+    void displayedSlotChanged();
     void reverseButtonClicked();
     void drawAudioWaveform();
 
@@ -48,12 +51,35 @@ private:
     juce::AudioProcessorValueTreeState& valueTreeState;
     
     
-    juce::AudioFormatManager formatManager;
-    juce::AudioThumbnailCache thumbnailCache;
-    juce::AudioThumbnail thumbnail;
+    juce::Rectangle<int> getThumbnailBounds() const;
+    int getDisplayedSlot() const;
+    
+    //Shared decode from the processor, drawn once into a cached image
+    std::shared_ptr<const LoadedIR> displayedIR;
+    juce::Image waveformImage;
+    
+    //Read when the processor broadcasts a change, so paint() never waits on the engines' lock
+    int displayedDroppedSamples = 0;
     
     juce::TextButton openButton;
     
+    juce::TextButton reverseButton;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ButtonAttachment> reverseAttch;
+    
+    juce::TextButton captureButton;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ButtonAttachment> captureAttch;
+    
+   #if DYNCONV_TRACE
+    juce::TextButton saveTraceButton;
+    void saveTraceButtonClicked();
+   #endif
+    
+    //IR shaping knobs, Low Cut, High Cut, Tilt and Damping
+    static constexpr int numShapingKnobs = 4;
+    std::array<juce::Slider, numShapingKnobs> shapingSliders;
+    std::array<juce::Label, numShapingKnobs> shapingLabels;
+    std::array<std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment>, numShapingKnobs> shapingAttchs;
+    
     juce::Slider filePosSlider;
     juce::Label  fPosLabel;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> filePosAttch;
@@ -66,6 +92,16 @@ private:
     juce::Label dwLabel;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> dryWetAttch;
     
+    juce::ComboBox loadSlotBox;
+    
+    juce::ComboBox slotABox;
+    juce::ComboBox slotBBox;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment> slotAAttch;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment> slotBAttch;
+    
+    juce::Slider morphSlider;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> morphAttch;
+    
     //Custom Graphics Component
     std::unique_ptr<FileHighlight> fileHighlight;
     
@@ -8,6 +8,7 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "Trace.h"
 
 //==============================================================================
 Dynamic_ConvolverAudioProcessor::Dynamic_ConvolverAudioProcessor()
@@ -16,6 +17,7 @@ Dynamic_ConvolverAudioProcessor::Dynamic_ConvolverAudioProcessor()
                      #if ! JucePlugin_IsMidiEffect
                       #if ! JucePlugin_IsSynth
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                       .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
@@ -23,6 +25,10 @@ Dynamic_ConvolverAudioProcessor::Dynamic_ConvolverAudioProcessor()
         parameters(*this, nullptr, "PARAMETERS", createParameterLayout())
 #endif
 {
+    //The message thread loads IRs, and the host's audio thread claims the buffer set aside for it on its first event
+    DYNCONV_TRACE_REGISTER_THREAD();
+    DYNCONV_TRACE_RESERVE_THREADS(1);
+    
     d2_conv = std::make_unique<DynamicConvolutionEffect>(parameters);
 }
 
@@ -33,17 +39,8 @@ Dynamic_ConvolverAudioProcessor::~Dynamic_ConvolverAudioProcessor()
 //==============================================================================
 juce::AudioProcessorValueTreeState::ParameterLayout Dynamic_ConvolverAudioProcessor::createParameterLayout()
 {
-    int versionHint = 1;
-    
-    using namespace juce;
-    
-    return
-    {
-        std::make_unique<AudioParameterFloat>(ParameterID {"FILE_LEN", versionHint}, "File Length", 0.0f, 1.0f, 1.0f),
-        std::make_unique<AudioParameterFloat> (ParameterID{"FILE_POS", versionHint},  "File Pos", 0.0f, 1.0f, 0.0f),
-        std::make_unique<AudioParameterFloat>(ParameterID {"DRY_WET", versionHint},
-                                              "Dry/Wet", 0.0f, 1.0f, 0.5f)
-    };
+    //Declared with the effect that reads them, so it can be tested without the plugin
+    return DynamicConvolutionEffect::createParameterLayout();
 }
 
 const juce::String Dynamic_ConvolverAudioProcessor::getName() const
@@ -112,7 +109,8 @@ void Dynamic_ConvolverAudioProcessor::prepareToPlay (double sampleRate, int samp
 {
 
 
-    d2_conv->prepare(samplesPerBlock);
+    d2_conv->prepare(sampleRate, samplesPerBlock, isNonRealtime());
+    setLatencySamples(d2_conv->getLatencySamples());
 
 }
 
@@ -141,6 +139,13 @@ bool Dynamic_ConvolverAudioProcessor::isBusesLayoutSupported (const BusesLayout&
    #if ! JucePlugin_IsSynth
     if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
         return false;
+    
+    // The sidechain is only used for capturing IRs, so it's optional
+    auto sidechain = layouts.getChannelSet (true, 1);
+    if (! sidechain.isDisabled()
+     && sidechain != juce::AudioChannelSet::mono()
+     && sidechain != juce::AudioChannelSet::stereo())
+        return false;
    #endif
 
     return true;
@@ -152,7 +157,17 @@ void Dynamic_ConvolverAudioProcessor::processBlock (juce::AudioBuffer<float>& bu
 {
     juce::ScopedNoDenormals noDenormals;
     
-    d2_conv->processBlock(buffer);
+    d2_conv->processBlock(getBusBuffer(buffer, true, 0), getBusBuffer(buffer, true, 1));
+}
+
+void Dynamic_ConvolverAudioProcessor::setNonRealtime (bool isNonRealtime) noexcept
+{
+    juce::AudioProcessor::setNonRealtime (isNonRealtime);
+    
+    //Bounces switch to the large partition engines, which report their latency
+    //Most hosts call this before processing, one that calls it from the audio thread only pays for it going offline
+    d2_conv->setNonRealtime (isNonRealtime);
+    setLatencySamples (d2_conv->getLatencySamples());
 }
 
 //==============================================================================
@@ -0,0 +1,75 @@
+/*
+  ==============================================================================
+
+    SpectrumShaper.cpp
+    Created: 20 Oct 2026 9:41:17am
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#include "SpectrumShaper.h"
+#include "DynamicConvolver.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+
+
+SpectrumShaper::SpectrumShaper() : juce::Thread("IR Spectrum Shaper")
+{
+    startThread();
+}
+
+SpectrumShaper::~SpectrumShaper()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(4000);
+}
+
+void SpectrumShaper::addEngine(DynamicConvolverV2* engine)
+{
+    const juce::ScopedLock sl(lock);
+    engines.push_back(engine);
+    engine->setShaper(this);
+    notify();
+}
+
+void SpectrumShaper::removeEngine(DynamicConvolverV2* engine)
+{
+    const juce::ScopedLock sl(lock);
+    engines.erase(std::remove(engines.begin(), engines.end(), engine), engines.end());
+    engine->setShaper(nullptr);
+}
+
+void SpectrumShaper::requestUpdate()
+{
+    notify();
+}
+
+void SpectrumShaper::run()
+{
+    DYNCONV_TRACE_REGISTER_THREAD();
+    
+    while(!threadShouldExit())
+    {
+        //Changes that come in during a pass are picked up by the next one, a knob drag costs a pass at a time
+        auto didWork = false;
+        auto isCapturing = false;
+
+        {
+            const juce::ScopedLock sl(lock);
+
+            for(auto* engine : engines)
+            {
+                didWork = engine->updateShaping() || didWork;
+                isCapturing = isCapturing || engine->isShapingCapture();
+            }
+        }
+
+        //The audio thread doesn't wake the shaper for captured partitions, so it checks for them while one runs
+        if(!didWork)
+            wait(isCapturing ? 2 : -1);
+    }
+}
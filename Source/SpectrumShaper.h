@@ -0,0 +1,41 @@
+/*
+  ==============================================================================
+
+    SpectrumShaper.h
+    Created: 20 Oct 2026 9:41:17am
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <vector>
+
+
+class DynamicConvolverV2;
+
+//Background thread that rebuilds the shaped IR spectra of its engines
+//The engines wake it whenever their shaping or one of their IRs changes
+class SpectrumShaper : private juce::Thread
+{
+public:
+    SpectrumShaper();
+    ~SpectrumShaper() override;
+
+    //Engines have to be removed again before they're destroyed
+    void addEngine(DynamicConvolverV2* engine);
+    void removeEngine(DynamicConvolverV2* engine);
+
+    void requestUpdate();
+
+private:
+    void run() override;
+
+    juce::CriticalSection lock;
+    std::vector<DynamicConvolverV2*> engines;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpectrumShaper)
+};
@@ -0,0 +1,264 @@
+/*
+  ==============================================================================
+
+    Trace.cpp
+    Created: 19 Oct 2026 10:12:31pm
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#include "Trace.h"
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+
+
+namespace DynConvTrace
+{
+    namespace
+    {
+        //Buffers are only ever added, and kept after their thread exits so its events can still be exported
+        //Adding one takes the lock, claiming and reading them doesn't, so only registerThread() and
+        //reserveThreadBuffers() add them, never an event
+        struct Registry
+        {
+            static constexpr int maxBuffers = 256;
+
+            juce::CriticalSection lock;
+            std::array<std::unique_ptr<ThreadBuffer>, maxBuffers> buffers;
+            std::atomic<int> numBuffers {0};
+
+            ThreadBuffer* add(bool claimed)
+            {
+                const juce::ScopedLock sl(lock);
+                auto index = numBuffers.load();
+
+                if(index == maxBuffers)
+                    return nullptr;
+
+                buffers[static_cast<size_t>(index)] = std::make_unique<ThreadBuffer>(index + 1);
+                auto* buffer = buffers[static_cast<size_t>(index)].get();
+                buffer->isClaimed.store(claimed);
+
+                numBuffers.store(index + 1, std::memory_order_release);
+                return buffer;
+            }
+
+            std::vector<ThreadBuffer*> getBuffers() const
+            {
+                std::vector<ThreadBuffer*> result;
+                auto count = numBuffers.load(std::memory_order_acquire);
+
+                for(auto i = 0; i < count; ++i)
+                    result.push_back(buffers[static_cast<size_t>(i)].get());
+
+                return result;
+            }
+        };
+
+        Registry& getRegistry()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        //Copying a thread's name only shares its text, host threads are named when exported
+        void nameBuffer(ThreadBuffer* buffer)
+        {
+            if(buffer != nullptr)
+                if(auto* thread = juce::Thread::getCurrentThread())
+                    buffer->name = thread->getThreadName();
+        }
+
+        //A spare one from reserveThreadBuffers(), never allocates
+        ThreadBuffer* claimSpareBuffer()
+        {
+            auto& registry = getRegistry();
+
+            for(auto i = 0; i < registry.numBuffers.load(std::memory_order_acquire); ++i)
+            {
+                auto* candidate = registry.buffers[static_cast<size_t>(i)].get();
+                if(!candidate->isClaimed.exchange(true))
+                {
+                    nameBuffer(candidate);
+                    return candidate;
+                }
+            }
+
+            return nullptr;
+        }
+
+        struct ThreadState
+        {
+            ThreadBuffer* buffer = nullptr;
+            int numBuffersSeen = -1; //Buffers there were when the thread last found no spare
+        };
+
+        ThreadState& getThreadState()
+        {
+            thread_local ThreadState state;
+            return state;
+        }
+
+        ThreadBuffer* getThreadBuffer()
+        {
+            auto& state = getThreadState();
+
+            //Only looks again once more buffers were reserved
+            if(state.buffer == nullptr)
+            {
+                auto numBuffers = getRegistry().numBuffers.load(std::memory_order_acquire);
+
+                if(numBuffers != state.numBuffersSeen)
+                {
+                    state.buffer = claimSpareBuffer();
+                    state.numBuffersSeen = numBuffers;
+                }
+            }
+
+            return state.buffer;
+        }
+
+        struct CopiedEvent
+        {
+            const char* name;
+            juce::int64 startTicks;
+            juce::int64 endTicks;
+        };
+    }
+
+    //==============================================================================
+    ThreadBuffer::ThreadBuffer(int threadIndex)
+        : index(threadIndex)
+    {
+    }
+
+    void ThreadBuffer::add(const char* eventName, juce::int64 startTicks, juce::int64 endTicks) noexcept
+    {
+        auto position = writeIndex.load(std::memory_order_relaxed);
+        auto& event = events[position % capacity];
+
+        event.name.store(eventName, std::memory_order_relaxed);
+        event.startTicks.store(startTicks, std::memory_order_relaxed);
+        event.endTicks.store(endTicks, std::memory_order_relaxed);
+
+        writeIndex.store(position + 1, std::memory_order_release);
+    }
+
+    void record(const char* name, juce::int64 startTicks, juce::int64 endTicks)
+    {
+        if(auto* buffer = getThreadBuffer())
+            buffer->add(name, startTicks, endTicks);
+    }
+
+    void registerThread()
+    {
+        auto& state = getThreadState();
+
+        //Its own buffer, so the spares are left for the threads that can't allocate
+        if(state.buffer == nullptr)
+        {
+            state.buffer = getRegistry().add(true);
+            nameBuffer(state.buffer);
+        }
+    }
+
+    void reserveThreadBuffers(int numThreads)
+    {
+        auto& registry = getRegistry();
+
+        for(auto i = 0; i < numThreads; ++i)
+            if(registry.add(false) == nullptr)
+                break;
+    }
+
+    int getNumThreadBuffers()
+    {
+        return getRegistry().numBuffers.load();
+    }
+
+    void clear()
+    {
+        for(auto* buffer : getRegistry().getBuffers())
+            buffer->readIndex.store(buffer->writeIndex.load(std::memory_order_acquire));
+    }
+
+    bool exportChromeTrace(const juce::File& file)
+    {
+        struct ThreadEvents
+        {
+            int index;
+            juce::String name;
+            std::vector<CopiedEvent> events;
+        };
+
+        std::vector<ThreadEvents> threads;
+
+        //Nothing is locked, so exporting never holds up a thread claiming its buffer
+        for(auto* buffer : getRegistry().getBuffers())
+        {
+            auto capacity = static_cast<juce::uint64>(ThreadBuffer::capacity);
+            auto end = buffer->writeIndex.load(std::memory_order_acquire);
+            auto begin = std::max(buffer->readIndex.load(), end > capacity ? end - capacity : 0);
+
+            //Spare, or claimed but nothing recorded yet, its name may still be being written
+            if(end == 0)
+                continue;
+
+            ThreadEvents copied {buffer->index, buffer->name.isNotEmpty() ? buffer->name : "Host thread " + juce::String(buffer->index), {}};
+            copied.events.reserve(static_cast<size_t>(end - begin));
+
+            for(auto i = begin; i < end; ++i)
+            {
+                auto& event = buffer->events[i % capacity];
+                copied.events.push_back({event.name.load(std::memory_order_relaxed),
+                                         event.startTicks.load(std::memory_order_relaxed),
+                                         event.endTicks.load(std::memory_order_relaxed)});
+            }
+
+            //The owner kept writing while we copied, drop whatever it may have overwritten
+            auto endAfterCopy = buffer->writeIndex.load(std::memory_order_acquire);
+            auto firstIntact = endAfterCopy + 1 > capacity ? endAfterCopy + 1 - capacity : 0;
+
+            if(firstIntact > begin)
+            {
+                auto numLost = std::min(static_cast<size_t>(firstIntact - begin), copied.events.size());
+                copied.events.erase(copied.events.begin(), copied.events.begin() + static_cast<std::ptrdiff_t>(numLost));
+            }
+
+            threads.push_back(std::move(copied));
+        }
+
+        //Timestamps start at the earliest event, in microseconds as the format expects
+        auto firstTicks = std::numeric_limits<juce::int64>::max();
+        for(auto& thread : threads)
+            for(auto& event : thread.events)
+                firstTicks = std::min(firstTicks, event.startTicks);
+
+        auto toMicroseconds = [](juce::int64 ticks)
+        {
+            return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e6, 3);
+        };
+
+        juce::StringArray entries;
+
+        for(auto& thread : threads)
+        {
+            entries.add("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + juce::String(thread.index)
+                        + ",\"args\":{\"name\":\"" + thread.name.replace("\"", "'") + "\"}}");
+
+            for(auto& event : thread.events)
+            {
+                entries.add("{\"name\":\"" + juce::String(event.name) + "\",\"cat\":\"dsp\",\"ph\":\"X\""
+                            + ",\"ts\":" + toMicroseconds(event.startTicks - firstTicks)
+                            + ",\"dur\":" + toMicroseconds(event.endTicks - event.startTicks)
+                            + ",\"pid\":1,\"tid\":" + juce::String(thread.index) + "}");
+            }
+        }
+
+        return file.replaceWithText("{\"traceEvents\":[\n" + entries.joinIntoString(",\n") + "\n],\"displayTimeUnit\":\"ms\"}\n");
+    }
+}
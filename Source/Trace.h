@@ -0,0 +1,109 @@
+/*
+  ==============================================================================
+
+    Trace.h
+    Created: 19 Oct 2026 10:12:31pm
+    Author:  Benjamin Ward
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <array>
+#include <atomic>
+
+
+//Scoped trace points, compiled in with DYNCONV_TRACE=1 and gone otherwise
+//DYNCONV_TRACE_SCOPE("Forward FFT") records how long the rest of the enclosing scope takes
+#if DYNCONV_TRACE
+ #define DYNCONV_TRACE_SCOPE(name) const DynConvTrace::ScopedEvent JUCE_JOIN_MACRO(dynConvTraceScope, __LINE__) (name)
+ #define DYNCONV_TRACE_REGISTER_THREAD() DynConvTrace::registerThread()
+ #define DYNCONV_TRACE_RESERVE_THREADS(numThreads) DynConvTrace::reserveThreadBuffers(numThreads)
+#else
+ #define DYNCONV_TRACE_SCOPE(name)
+ #define DYNCONV_TRACE_REGISTER_THREAD()
+ #define DYNCONV_TRACE_RESERVE_THREADS(numThreads)
+#endif
+
+
+namespace DynConvTrace
+{
+    //Writes every event still held by the thread buffers as Chrome trace JSON,
+    //which opens in chrome://tracing and ui.perfetto.dev
+    bool exportChromeTrace(const juce::File& file);
+
+    //Forgets everything recorded so far
+    void clear();
+
+    //Records one complete event on the calling thread, name must be a string literal
+    //Lock and allocation free, a thread that didn't register claims a reserved buffer on its first event,
+    //and its events are dropped while there is none spare
+    void record(const char* name, juce::int64 startTicks, juce::int64 endTicks);
+
+    //Allocates the calling thread its own buffer, for threads we start, never the audio thread
+    void registerThread();
+
+    //Adds spare buffers for threads we don't start, like the host's audio threads, which claim one on their first event
+    void reserveThreadBuffers(int numThreads);
+
+    //Buffers allocated so far, claimed or spare
+    int getNumThreadBuffers();
+
+    class ScopedEvent
+    {
+    public:
+        explicit ScopedEvent(const char* eventName) noexcept
+            : name(eventName), startTicks(juce::Time::getHighResolutionTicks())
+        {
+        }
+
+        ~ScopedEvent()
+        {
+            record(name, startTicks, juce::Time::getHighResolutionTicks());
+        }
+
+    private:
+        const char* name;
+        juce::int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedEvent)
+    };
+
+    //Ring of the most recent events of one thread
+    //Only the owning thread writes, the exporter copies it out and drops anything overwritten meanwhile
+    class ThreadBuffer
+    {
+    public:
+        static constexpr int capacity = 1 << 14;
+
+        explicit ThreadBuffer(int threadIndex);
+
+        void add(const char* name, juce::int64 startTicks, juce::int64 endTicks) noexcept;
+
+        const int index;
+
+        //Set once by the thread that claims it, before its first event
+        juce::String name;
+        std::atomic<bool> isClaimed {false};
+
+    private:
+        friend bool exportChromeTrace(const juce::File&);
+        friend void clear();
+
+        struct Event
+        {
+            std::atomic<const char*> name {nullptr};
+            std::atomic<juce::int64> startTicks {0};
+            std::atomic<juce::int64> endTicks {0};
+        };
+
+        std::array<Event, capacity> events;
+        std::atomic<juce::uint64> writeIndex {0};
+        std::atomic<juce::uint64> readIndex {0};
+
+        JUCE_DECLARE_NON_COPYABLE(ThreadBuffer)
+    };
+}
@@ -0,0 +1,1970 @@
+/*
+  ==============================================================================
+
+    EngineTests.cpp
+    Created: 19 Oct 2026 5:03:52pm
+    Author:  Benjamin Ward
+
+    Reference accuracy and performance tests for DynamicConvolverV2.
+    Every case is checked against a brute force direct convolution and
+    timed, the timings are written out so they can be compared between
+    builds.
+
+    Options:
+      --bench=<file>       Write the timing of every case to <file>
+      --baseline=<file>    Fail if a case got slower than in <file>
+      --tolerance=<x>      Allowed slowdown against the baseline (default 1.25)
+      --trace=<file>       Write a Chrome trace of the run (needs DYNCONV_TRACE)
+
+  ==============================================================================
+*/
+
+#include "DSPScheduler.h"
+#include "DynamicConvolutionEffect.h"
+#include "DynamicConvolver.h"
+#include "MemoryBudget.h"
+#include "SpectrumShaper.h"
+#include "Trace.h"
+
+#include <juce_core/juce_core.h>
+
+#include <algorithm>
+#include <complex>
+#include <functional>
+#include <span>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+    constexpr double sampleRate = 48000.0;
+
+    struct CaseTiming
+    {
+        juce::String name;
+        double microsecondsPerBlock = 0.0;
+        double realtimeFactor = 0.0;
+        double maxError = 0.0;
+    };
+
+    std::vector<CaseTiming>& getTimings()
+    {
+        static std::vector<CaseTiming> timings;
+        return timings;
+    }
+
+    struct EngineCase
+    {
+        int blockSize = 512;
+        int irLength = 4096;
+        float filePos = 0.0f;
+        float fileLen = 1.0f;
+        float dryWet = 1.0f;
+        int numBlocks = 0; //0 = enough blocks to hear the whole window
+        bool compact = false;
+        DSPScheduler* scheduler = nullptr;
+        bool reverse = false;
+        int callSize = 0; //0 = whole blocks
+        bool randomCalls = false; //Calls of any length up to callSize
+        bool automate = false; //Moves the window a little on every call
+        int maxWindowLength = 0; //0 = the whole slot
+        int windowGrid = 0; //Offline engines, windows cut on the realtime block size
+
+        juce::String getName() const
+        {
+            return "block " + juce::String(blockSize) + ", ir " + juce::String(irLength)
+                 + ", pos " + juce::String(filePos, 2) + ", len " + juce::String(fileLen, 2)
+                 + ", mix " + juce::String(dryWet, 2) + (compact ? ", compact" : "")
+                 + (scheduler != nullptr ? ", scheduled" : "") + (reverse ? ", reversed" : "")
+                 + (callSize > 0 ? (randomCalls ? ", calls up to " : ", calls of ") + juce::String(callSize) : "")
+                 + (automate ? ", automated" : "")
+                 + (maxWindowLength > 0 ? ", window up to " + juce::String(maxWindowLength) : "")
+                 + (windowGrid > 0 ? ", grid " + juce::String(windowGrid) : "");
+        }
+    };
+
+    std::vector<float> makeNoise(juce::Random& random, int numSamples, float decay = 0.0f)
+    {
+        std::vector<float> data(static_cast<size_t>(numSamples));
+        for(auto i = 0; i < numSamples; ++i)
+            data[i] = (random.nextFloat() * 2.0f - 1.0f) * std::exp(-decay * i / numSamples);
+
+        return data;
+    }
+
+    //Mirrors the window the engine selects, cut to the sample but kept in place on the partition grid
+    //Worked out on the IR's own length, only IRs longer than the slot are cut to whole partitions
+    std::vector<float> getWindow(const std::vector<float>& ir, const EngineCase& c, float& gain)
+    {
+        auto totalSamples = std::min(c.irLength, 400 * c.blockSize);
+        auto cutStart = static_cast<int>(static_cast<double>(c.filePos) * totalSamples);
+        auto cutEnd = std::min(totalSamples, static_cast<int>(static_cast<double>(c.fileLen) * totalSamples) + cutStart);
+
+        if(c.maxWindowLength > 0)
+            cutEnd = std::min(cutEnd, cutStart + c.maxWindowLength);
+
+        auto start = cutStart / c.blockSize * c.blockSize;
+        auto end = cutEnd > cutStart ? (cutEnd + c.blockSize - 1) / c.blockSize * c.blockSize : start;
+
+        gain = 512.0f / static_cast<float>(totalSamples);
+
+        std::vector<float> window;
+        for(auto i = start; i < end; ++i)
+            window.push_back(i >= cutStart && i < cutEnd && i < c.irLength ? ir[i] : 0.0f);
+
+        //Reverse plays the partition aligned window backwards, padding included
+        if(c.reverse)
+            std::reverse(window.begin(), window.end());
+
+        return window;
+    }
+
+    std::vector<float> directConvolution(const std::vector<float>& input, const std::vector<float>& window,
+                                         float gain, float dryWet)
+    {
+        std::vector<float> output(input.size());
+
+        for(size_t n = 0; n < input.size(); ++n)
+        {
+            double sum = 0.0;
+            auto numTaps = std::min(window.size(), n + 1);
+            for(size_t k = 0; k < numTaps; ++k)
+                sum += static_cast<double>(input[n - k]) * window[k];
+
+            output[n] = static_cast<float>(sum * gain * dryWet + (1.0 - dryWet) * input[n]);
+        }
+
+        return output;
+    }
+
+    //Runs the engine over random noise, returns the error against the reference and records the timing
+    double runCase(const EngineCase& c, juce::Random& random, bool checkAccuracy)
+    {
+        auto ir = makeNoise(random, c.irLength, 6.0f);
+
+        float gain = 1.0f;
+        auto window = getWindow(ir, c, gain);
+
+        auto numBlocks = c.numBlocks > 0 ? c.numBlocks
+                                         : static_cast<int>(window.size()) / c.blockSize + 4;
+        auto input = makeNoise(random, numBlocks * c.blockSize);
+
+        DynamicConvolverV2 engine;
+        engine.setSpectrumStorage(c.compact ? DynamicConvolverV2::SpectrumStorage::compact
+                                            : DynamicConvolverV2::SpectrumStorage::full);
+        engine.setScheduler(c.scheduler);
+        engine.setReverse(c.reverse);
+        engine.setMaxWindowLength(c.maxWindowLength);
+        engine.setWindowGrid(c.windowGrid);
+
+        if(c.windowGrid > 0)
+            engine.prepare(c.blockSize, (DynamicConvolverV2::maxPartitions * c.windowGrid + c.blockSize - 1) / c.blockSize);
+        else
+            engine.prepare(c.blockSize);
+
+        engine.loadNewIR(ir);
+        engine.setParameters(c.filePos, c.fileLen, c.dryWet);
+
+        auto output = input;
+        auto startTicks = juce::Time::getHighResolutionTicks();
+
+        auto callSize = c.callSize > 0 ? c.callSize : c.blockSize;
+        for(size_t position = 0, call = 0; position < output.size(); ++call)
+        {
+            auto numSamples = std::min(static_cast<size_t>(c.randomCalls ? 1 + random.nextInt(callSize) : callSize),
+                                       output.size() - position);
+
+            if(c.automate)
+                engine.setParameters(c.filePos + 0.1f * static_cast<float>(call % 64) / 64.0f, c.fileLen, c.dryWet);
+
+            engine.process(std::span<float>(output.data() + position, numSamples));
+            position += numSamples;
+        }
+
+        auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+
+        double maxError = 0.0;
+        if(checkAccuracy)
+        {
+            auto reference = directConvolution(input, window, gain, c.dryWet);
+
+            double peak = 1.0e-9;
+            for(auto sample : reference)
+                peak = std::max(peak, (double) std::abs(sample));
+
+            for(size_t i = 0; i < output.size(); ++i)
+                maxError = std::max(maxError, std::abs((double) output[i] - reference[i]) / peak);
+        }
+
+        CaseTiming timing;
+        timing.name = c.getName();
+        timing.microsecondsPerBlock = seconds * 1.0e6 / numBlocks;
+        timing.realtimeFactor = (numBlocks * c.blockSize / sampleRate) / std::max(seconds, 1.0e-9);
+        timing.maxError = maxError;
+
+        //Cases can run on several threads at once when they share a scheduler
+        static juce::CriticalSection timingLock;
+        const juce::ScopedLock lock(timingLock);
+        getTimings().push_back(timing);
+
+        return maxError;
+    }
+}
+
+//==============================================================================
+class TraceExportTests : public juce::UnitTest
+{
+public:
+    //Registered first, so it has cleared its own events again before the engine tests record theirs
+    TraceExportTests() : juce::UnitTest("Trace export", "DynamicConvolver") {}
+
+    void runTest() override
+    {
+        beginTest("Events from every thread end up in the trace");
+        {
+            auto file = juce::File::getSpecialLocation(juce::File::tempDirectory).getNonexistentChildFile("dynconv_trace", ".json");
+
+            DynConvTrace::clear();
+            DynConvTrace::record("Test event", 1000, 2000);
+
+            std::thread worker([]
+            {
+                DynConvTrace::registerThread();
+                DynConvTrace::record("Worker event", 1500, 1700);
+            });
+            worker.join();
+
+            expect(DynConvTrace::exportChromeTrace(file));
+
+            auto json = file.loadFileAsString();
+            expect(json.startsWith("{\"traceEvents\":["));
+            expect(json.contains("\"name\":\"Test event\""));
+            expect(json.contains("\"name\":\"Worker event\""));
+            expect(json.contains("\"ph\":\"X\""));
+            file.deleteFile();
+
+            //Cleared events aren't exported again
+            DynConvTrace::clear();
+            expect(DynConvTrace::exportChromeTrace(file));
+            expect(!file.loadFileAsString().contains("Test event"));
+            file.deleteFile();
+        }
+
+        beginTest("Unregistered threads only take reserved buffers");
+        {
+            auto file = juce::File::getSpecialLocation(juce::File::tempDirectory).getNonexistentChildFile("dynconv_trace", ".json");
+            DynConvTrace::clear();
+
+            //Nothing before this test reserves a buffer, so the one reserved here is the only spare
+            auto numBuffers = DynConvTrace::getNumThreadBuffers();
+            DynConvTrace::reserveThreadBuffers(1);
+            expectEquals(DynConvTrace::getNumThreadBuffers(), numBuffers + 1);
+
+            //Takes the reserved one
+            std::thread first([] { DynConvTrace::record("First thread", 1000, 1100); });
+            first.join();
+            expectEquals(DynConvTrace::getNumThreadBuffers(), numBuffers + 1);
+
+            //Registering allocates a buffer of its own rather than taking a spare
+            std::thread second([] { DynConvTrace::registerThread(); });
+            second.join();
+            expectEquals(DynConvTrace::getNumThreadBuffers(), numBuffers + 2);
+
+            //None spare, the event is dropped rather than allocating on a thread that may be the audio thread
+            std::thread third([] { DynConvTrace::record("Third thread", 1000, 1100); });
+            third.join();
+            expectEquals(DynConvTrace::getNumThreadBuffers(), numBuffers + 2);
+
+            expect(DynConvTrace::exportChromeTrace(file));
+            auto json = file.loadFileAsString();
+            expect(json.contains("\"name\":\"First thread\""));
+            expect(!json.contains("\"name\":\"Third thread\""));
+            file.deleteFile();
+        }
+    }
+};
+
+static TraceExportTests traceExportTests;
+
+//==============================================================================
+class EngineAccuracyTests : public juce::UnitTest
+{
+public:
+    EngineAccuracyTests() : juce::UnitTest("Engine accuracy", "DynamicConvolver") {}
+
+    void runTest() override
+    {
+        //Relative to the peak of the reference output
+        constexpr double tolerance = 1.0e-4;
+
+        beginTest("Full window matches direct convolution");
+        {
+            for(auto blockSize : {64, 128, 256, 512, 1024})
+            {
+                EngineCase c;
+                c.blockSize = blockSize;
+                c.irLength = 3 * blockSize + 17;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+            }
+        }
+
+        beginTest("Edge windows");
+        {
+            const EngineCase cases[] =
+            {
+                {256, 4000, 0.0f, 0.07f, 1.0f},  //Single partition
+                {256, 4000, 0.95f, 1.0f, 1.0f},  //Last partition only
+                {256, 4000, 0.5f, 1.0f, 1.0f},   //Window clipped at the end of the IR
+                {512, 100, 0.0f, 1.0f, 1.0f},    //IR shorter than one block
+                {128, 2048, 0.25f, 0.5f, 0.3f},  //Dry/Wet mix
+            };
+
+            for(auto& c : cases)
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+        }
+
+        beginTest("Random IRs, blocks and windows");
+        {
+            const int blockSizes[] = {32, 64, 128, 256, 512, 1024};
+
+            for(auto i = 0; i < 24; ++i)
+            {
+                EngineCase c;
+                c.blockSize = blockSizes[random.nextInt(6)];
+                c.irLength = 1 + random.nextInt(6000);
+                c.filePos = random.nextFloat();
+                c.fileLen = random.nextFloat();
+                c.dryWet = random.nextFloat();
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+            }
+        }
+
+        beginTest("Compact spectrum storage");
+        {
+            //int16 spectra, the error is recorded in the timings so the accuracy cost can be tracked
+            constexpr double compactTolerance = 2.0e-4;
+
+            for(auto blockSize : {64, 256, 1024})
+            {
+                EngineCase c;
+                c.blockSize = blockSize;
+                c.irLength = 12 * blockSize + 5;
+                c.filePos = 0.1f;
+                c.fileLen = 0.8f;
+                c.compact = true;
+                expectLessThan(runCase(c, random, true), compactTolerance, c.getName());
+            }
+
+            DynamicConvolverV2 full, compact;
+            compact.setSpectrumStorage(DynamicConvolverV2::SpectrumStorage::compact);
+            full.prepare(512);
+            compact.prepare(512);
+            expectLessThan((double) compact.getSpectrumMemoryBytes(), 0.6 * (double) full.getSpectrumMemoryBytes(),
+                           "compact storage should roughly halve the spectrum memory");
+        }
+
+        beginTest("Morph between slots");
+        {
+            for(auto morph : {0.0f, 0.3f, 1.0f})
+            {
+                //Different lengths, so part of the window only comes from slot A
+                EngineCase a {256, 3000, 0.2f, 0.6f, 1.0f};
+                EngineCase b {256, 1200, 0.2f, 0.6f, 1.0f};
+                expectLessThan(runMorphCase(a, b, morph), tolerance, "morph " + juce::String(morph, 2));
+            }
+        }
+
+        beginTest("Reversed window");
+        {
+            const EngineCase cases[] =
+            {
+                {256, 4000, 0.0f, 1.0f, 1.0f},   //Whole IR, partly filled last partition
+                {128, 2048, 0.25f, 0.5f, 0.7f},  //Window in the middle
+                {64, 1000, 0.9f, 1.0f, 1.0f},    //Tail only
+                {512, 300, 0.0f, 1.0f, 1.0f},    //Single partition
+            };
+
+            for(auto c : cases)
+            {
+                c.reverse = true;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+
+                c.compact = true;
+                expectLessThan(runCase(c, random, true), 2.0e-4, c.getName());
+            }
+        }
+
+        beginTest("Window cut to the sample");
+        {
+            const EngineCase cases[] =
+            {
+                {1024, 20000, 0.013f, 0.41f, 1.0f},  //Both edges inside a partition
+                {1024, 20000, 0.5f, 0.003f, 1.0f},   //Window shorter than a partition
+                {1024, 9000, 0.77f, 1.0f, 0.6f},     //Cut start, end at the IR's tail
+                {256, 5000, 0.0f, 0.333f, 1.0f},     //Cut end only
+            };
+
+            for(auto c : cases)
+            {
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+
+                c.reverse = true;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+
+                c.compact = true;
+                expectLessThan(runCase(c, random, true), 2.0e-4, c.getName());
+            }
+
+            //Moved by less than a partition on a running engine, the edges have to follow
+            constexpr int blockSize = 512;
+            auto ir = makeNoise(random, 12 * blockSize, 6.0f);
+            auto input = makeNoise(random, 40 * blockSize);
+
+            DynamicConvolverV2 moved, fresh;
+            for(auto* engine : {&moved, &fresh})
+            {
+                engine->prepare(blockSize);
+                engine->loadNewIR(ir);
+            }
+
+            moved.setParameters(0.21f, 0.5f, 1.0f);
+            fresh.setParameters(0.23f, 0.5f, 1.0f);
+
+            auto movedOutput = input;
+            auto freshOutput = input;
+            double maxError = 0.0, peak = 1.0e-9;
+
+            for(auto block = 0; block < 40; ++block)
+            {
+                if(block == 10)
+                    moved.setParameters(0.23f, 0.5f, 1.0f);
+
+                auto offset = static_cast<size_t>(block * blockSize);
+                moved.process(std::span<float>(movedOutput.data() + offset, static_cast<size_t>(blockSize)));
+                fresh.process(std::span<float>(freshOutput.data() + offset, static_cast<size_t>(blockSize)));
+
+                //Once the old window's tail has left the history
+                if(block < 24)
+                    continue;
+
+                for(auto i = offset; i < offset + blockSize; ++i)
+                {
+                    peak = std::max(peak, (double) std::abs(freshOutput[i]));
+                    maxError = std::max(maxError, (double) std::abs(movedOutput[i] - freshOutput[i]));
+                }
+            }
+
+            expectLessThan(maxError / peak, tolerance, "window moved inside its partitions");
+        }
+
+        beginTest("Same level and window at any partition size");
+        {
+            //Not a whole number of partitions at any of these sizes
+            auto ir = makeNoise(random, 5000, 3.0f);
+            constexpr int responseLength = 6000; //The whole IR and a little silence after it
+
+            auto getResponse = [&](int blockSize, float filePos, float fileLen)
+            {
+                DynamicConvolverV2 engine;
+                engine.prepare(blockSize);
+                engine.loadNewIR(ir);
+                engine.setParameters(filePos, fileLen, 1.0f);
+
+                //The window keeps its place on the partition grid, so its start is moved back to sample 0
+                auto response = getImpulseResponse(engine, blockSize, responseLength / blockSize + 2);
+                auto offset = static_cast<int>(static_cast<double>(filePos) * ir.size()) % blockSize;
+                return std::vector<float>(response.begin() + offset, response.begin() + offset + responseLength);
+            };
+
+            for(auto [filePos, fileLen] : {std::pair {0.0f, 1.0f}, std::pair {0.0f, 0.6f}, std::pair {0.37f, 0.5f}})
+            {
+                auto reference = getResponse(512, filePos, fileLen);
+                double peak = 1.0e-9;
+                for(auto sample : reference)
+                    peak = std::max(peak, (double) std::abs(sample));
+
+                for(auto blockSize : {64, 4096})
+                {
+                    auto response = getResponse(blockSize, filePos, fileLen);
+                    double maxError = 0.0;
+                    for(size_t i = 0; i < reference.size(); ++i)
+                        maxError = std::max(maxError, std::abs((double) response[i] - reference[i]));
+
+                    expectLessThan(maxError / peak, tolerance, "block " + juce::String(blockSize) + " against 512, pos "
+                                   + juce::String(filePos, 2) + ", len " + juce::String(fileLen, 2));
+                }
+            }
+        }
+
+        beginTest("Window limited to a maximum length");
+        {
+            //The input history only holds the longest window, longer ones are cut short at their end
+            for(auto maxWindowLength : {1, 700, 256 * 9, 256 * 9 + 1})
+            {
+                EngineCase c {256, 256 * 30 + 77, 0.13f, 0.8f, 0.7f};
+                c.maxWindowLength = maxWindowLength;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+
+                c.reverse = true;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+
+                c.reverse = false;
+                c.callSize = 100;
+                c.randomCalls = true;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+            }
+
+            DynamicConvolverV2 whole, limited;
+            limited.setMaxWindowLength(512 * 10);
+            whole.prepare(512);
+            limited.prepare(512);
+            expectLessThan((double) limited.getMemoryBytes(), (double) whole.getMemoryBytes() - 350.0 * 1026 * sizeof(float),
+                           "a short history should free most of the input spectra");
+        }
+
+        beginTest("Calls of any length");
+        {
+            //Hosts may cut their blocks anywhere, at automation points for one
+            for(auto callSize : {1, 100, 700})
+            {
+                EngineCase c {256, 256 * 30 + 77, 0.1f, 0.8f, 0.7f};
+                c.callSize = callSize;
+                c.randomCalls = true;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+
+                c.reverse = true;
+                expectLessThan(runCase(c, random, true), tolerance, c.getName());
+
+                c.compact = true;
+                expectLessThan(runCase(c, random, true), 2.0e-4, c.getName());
+            }
+        }
+
+        beginTest("Unprepared engine");
+        {
+            //Hosts may send a block before prepareToPlay, or after releaseResources
+            auto input = makeNoise(random, 300);
+            auto output = input;
+            
+            DynamicConvolverV2 engine;
+            engine.loadNewIR(makeNoise(random, 1000));
+            engine.process(std::span<float>(output));
+            expect(output == input, "an unprepared engine should pass its input through");
+            
+            engine.prepare(256);
+            engine.release();
+            engine.process(std::span<float>(output));
+            expect(output == input, "a released engine should pass its input through");
+        }
+
+        beginTest("Automation at any split");
+        {
+            constexpr int blockSize = 256;
+            auto irA = makeNoise(random, blockSize * 40 + 40, 3.0f);
+            auto irB = makeNoise(random, blockSize * 25 + 3, 2.0f);
+            auto input = makeNoise(random, blockSize * 80);
+
+            //Changes land anywhere in a block, and move the window, mix, morph and direction
+            struct Change
+            {
+                size_t position;
+                DynamicConvolverV2::WindowParameters parameters;
+            };
+
+            std::vector<Change> changes;
+            for(size_t position = 0; position < input.size(); position += static_cast<size_t>(1 + random.nextInt(blockSize * 3)))
+                changes.push_back({position, {random.nextFloat() * 0.5f, 0.2f + random.nextFloat() * 0.8f, 0.5f + random.nextFloat() * 0.5f,
+                                              0, 1, random.nextFloat(), random.nextBool()}});
+
+            //maxCallSize 0 cuts the calls at block ends and changes only, like a host splitting its blocks at automation
+            auto render = [&](int maxCallSize, DSPScheduler* scheduler)
+            {
+                DynamicConvolverV2 engine;
+                engine.setScheduler(scheduler);
+                engine.prepare(blockSize);
+                engine.loadNewIR(irA, 0);
+                engine.loadNewIR(irB, 1);
+
+                auto output = input;
+                for(size_t i = 0; i < changes.size(); ++i)
+                {
+                    auto end = i + 1 < changes.size() ? changes[i + 1].position : output.size();
+
+                    for(auto position = changes[i].position; position < end;)
+                    {
+                        auto numSamples = maxCallSize > 0 ? static_cast<size_t>(1 + random.nextInt(maxCallSize))
+                                                          : blockSize - position % blockSize;
+                        numSamples = std::min(numSamples, end - position);
+
+                        engine.process(std::span<float>(output.data() + position, numSamples), changes[i].parameters);
+                        position += numSamples;
+                    }
+                }
+
+                return output;
+            };
+
+            auto getError = [](const std::vector<float>& output, const std::vector<float>& reference)
+            {
+                double peak = 1.0e-9, maxError = 0.0;
+                for(size_t i = 0; i < reference.size(); ++i)
+                {
+                    peak = std::max(peak, (double) std::abs(reference[i]));
+                    maxError = std::max(maxError, (double) std::abs(output[i] - reference[i]));
+                }
+
+                return maxError / peak;
+            };
+
+            auto reference = render(0, nullptr);
+            DSPScheduler scheduler;
+
+            for(auto maxCallSize : {1, 37, 700})
+                expectLessThan(getError(render(maxCallSize, nullptr), reference), tolerance, "calls up to " + juce::String(maxCallSize));
+
+            expectLessThan(getError(render(300, &scheduler), reference), tolerance, "scheduled");
+        }
+
+        beginTest("Automation read once per host block");
+        {
+            //Hosts that don't split their blocks give one value per block, so renders at different block sizes differ
+            //They should differ no more than the same automation heard one host block late
+            constexpr int blockSize = 256;
+            auto irA = makeNoise(random, blockSize * 40 + 40, 3.0f);
+            auto irB = makeNoise(random, blockSize * 25 + 3, 2.0f);
+            auto input = makeNoise(random, blockSize * 60);
+
+            auto getParameters = [&input](size_t position)
+            {
+                auto t = static_cast<float>(position) / static_cast<float>(input.size());
+                return DynamicConvolverV2::WindowParameters {0.1f + 0.3f * t, 0.6f - 0.2f * t, 0.6f + 0.3f * t, 0, 1, t, false};
+            };
+
+            auto render = [&](int hostBlockSize, int lag)
+            {
+                DynamicConvolverV2 engine;
+                engine.prepare(blockSize);
+                engine.loadNewIR(irA, 0);
+                engine.loadNewIR(irB, 1);
+
+                auto output = input;
+                for(size_t position = 0; position < output.size(); position += static_cast<size_t>(hostBlockSize))
+                {
+                    auto numSamples = std::min(static_cast<size_t>(hostBlockSize), output.size() - position);
+                    engine.process(std::span<float>(output.data() + position, numSamples),
+                                   getParameters(position - std::min(position, static_cast<size_t>(lag))));
+                }
+
+                return output;
+            };
+
+            auto getRmsError = [](const std::vector<float>& output, const std::vector<float>& reference)
+            {
+                double error = 0.0, level = 1.0e-9;
+                for(size_t i = 0; i < reference.size(); ++i)
+                {
+                    error += juce::square((double) output[i] - reference[i]);
+                    level += juce::square((double) reference[i]);
+                }
+
+                return std::sqrt(error / level);
+            };
+
+            //Finely sampled automation stands in for a host that splits at every change
+            constexpr int fineBlockSize = 8;
+            auto reference = render(fineBlockSize, 0);
+
+            for(auto hostBlockSize : {64, 256, 1024})
+                expectLessThan(getRmsError(render(hostBlockSize, 0), reference), getRmsError(render(fineBlockSize, hostBlockSize), reference),
+                               "host blocks of " + juce::String(hostBlockSize));
+        }
+
+        beginTest("New block size swapped in mid-stream");
+        {
+            constexpr int oldBlockSize = 256;
+            constexpr int newBlockSize = 512;
+            constexpr size_t swapAt = oldBlockSize * 37;
+            auto input = makeNoise(random, newBlockSize * 60);
+
+            //Runs a reference at the old size against an old engine swapped for a new one, whose tail is added in
+            auto runSwap = [&](const std::vector<float>& ir, float filePos, float fileLen, DynamicConvolverV2& oldEngine)
+            {
+                DynamicConvolverV2 reference, newEngine;
+                for(auto* engine : {&reference, &oldEngine})
+                {
+                    engine->prepare(oldBlockSize);
+                    engine->loadNewIR(ir);
+                }
+
+                for(auto* engine : {&reference, &oldEngine, &newEngine})
+                    engine->setParameters(filePos, fileLen, 0.8f);
+
+                auto expected = input;
+                auto output = input;
+
+                for(size_t position = 0; position < input.size();)
+                {
+                    auto numSamples = std::min(static_cast<size_t>(position < swapAt ? oldBlockSize : newBlockSize), input.size() - position);
+                    reference.process(std::span<float>(expected.data() + position, numSamples));
+                    position += numSamples;
+                }
+
+                for(size_t position = 0; position < swapAt; position += oldBlockSize)
+                    oldEngine.process(std::span<float>(output.data() + position, static_cast<size_t>(oldBlockSize)));
+
+                //From the swap the new engine takes the input, and the old one plays out its tail on silence
+                newEngine.prepare(newBlockSize);
+                newEngine.copyIRsFrom(oldEngine);
+
+                auto tailRemaining = oldEngine.getTailLength();
+                std::vector<float> silence(static_cast<size_t>(newBlockSize));
+
+                for(auto position = swapAt; position < input.size(); position += newBlockSize)
+                {
+                    auto numSamples = std::min(static_cast<size_t>(newBlockSize), input.size() - position);
+                    newEngine.process(std::span<float>(output.data() + position, numSamples));
+
+                    if(tailRemaining > 0)
+                    {
+                        std::fill(silence.begin(), silence.end(), 0.0f);
+                        oldEngine.process(std::span<float>(silence.data(), numSamples));
+                        tailRemaining -= static_cast<int>(numSamples);
+
+                        for(size_t i = 0; i < numSamples; ++i)
+                            output[position + i] += silence[i];
+                    }
+                }
+
+                double peak = 1.0e-9, maxError = 0.0;
+                for(size_t i = 0; i < expected.size(); ++i)
+                {
+                    peak = std::max(peak, (double) std::abs(expected[i]));
+                    maxError = std::max(maxError, (double) std::abs(output[i] - expected[i]));
+                }
+
+                return maxError / peak;
+            };
+
+            //Whole partitions at both sizes
+            auto ir = makeNoise(random, newBlockSize * 20, 3.0f);
+            DynamicConvolverV2 oldEngine;
+            expectLessThan(runSwap(ir, 0.1f, 0.7f, oldEngine), tolerance, "old tail plus new engine");
+
+            //Partly filled last partition at both sizes, the level and window have to stay where they were
+            for(auto fileLen : {1.0f, 0.7f})
+            {
+                DynamicConvolverV2 shortEngine;
+                expectLessThan(runSwap(makeNoise(random, 5000, 3.0f), 0.0f, fileLen, shortEngine), tolerance,
+                               "5000 sample IR, len " + juce::String(fileLen, 2));
+            }
+
+            //Released engines hold no spectra, and play as before once prepared again
+            oldEngine.release();
+            expectEquals(static_cast<int>(oldEngine.getSpectrumMemoryBytes()), 0);
+
+            DynamicConvolverV2 fresh;
+            for(auto* engine : {&oldEngine, &fresh})
+            {
+                engine->prepare(128);
+                engine->setParameters(0.1f, 0.7f, 0.8f);
+            }
+
+            fresh.loadNewIR(ir);
+            expectLessThan(compareEngines(oldEngine, fresh, 128, 100), 1.0e-6, "prepared again after release");
+        }
+
+        beginTest("Memory budget");
+        {
+            constexpr int blockSize = 512;
+            auto ir = makeNoise(random, blockSize * 200, 6.0f);
+            auto getBytes = [](size_t bytes) { return static_cast<juce::int64>(bytes); };
+
+            MemoryBudget budget;
+
+            {
+                DynamicConvolverV2 first, second, third;
+                for(auto* engine : {&first, &second, &third})
+                    engine->setMemoryBudget(&budget);
+
+                first.prepare(blockSize);
+                first.loadNewIR(ir);
+                expectEquals(getBytes(budget.getUsedBytes()), getBytes(first.getMemoryBytes()), "one engine");
+                expect(first.getSpectrumStorage() == DynamicConvolverV2::SpectrumStorage::full);
+
+                //Room for a second engine's compact spectra, but not its full ones
+                budget.setLimit(budget.getUsedBytes() + first.getMemoryBytes() * 3 / 4);
+                second.prepare(blockSize);
+                expect(second.getSpectrumStorage() == DynamicConvolverV2::SpectrumStorage::compact, "second falls back to compact");
+                expectEquals(second.getPartitionCapacity(), DynamicConvolverV2::maxPartitions);
+                expectEquals(second.getMaxWindowLength(), 0);
+
+                //The rest only fits a shorter window and fewer partitions
+                third.prepare(blockSize);
+                expectLessOrEqual(budget.getUsedBytes(), budget.getLimit(), "the budget holds");
+                expect(third.getPartitionCapacity() < DynamicConvolverV2::maxPartitions, "third holds fewer partitions");
+                expectGreaterThan(third.getMaxWindowLength(), 0, "third has a limited window");
+
+                second.loadNewIR(ir);
+                third.loadNewIR(ir);
+                expectEquals(getBytes(budget.getUsedBytes()),
+                             getBytes(first.getMemoryBytes() + second.getMemoryBytes() + third.getMemoryBytes()), "three engines");
+
+                //Fewer partitions cut the end off the IR, which is reported rather than silently dropped
+                auto numDropped = third.getNumDroppedSamples(0);
+                expectEquals(first.getNumDroppedSamples(0), 0);
+                expectGreaterOrEqual(numDropped, std::max(0, static_cast<int>(ir.size()) - third.getPartitionCapacity() * blockSize),
+                                     "third reports what it cut");
+
+                //Plays the same as an engine set up like that without a budget, given what third kept of the IR
+                DynamicConvolverV2 reference;
+                reference.setSpectrumStorage(DynamicConvolverV2::SpectrumStorage::compact);
+                reference.setMaxWindowLength(third.getMaxWindowLength());
+                reference.prepare(blockSize, third.getPartitionCapacity());
+                reference.loadNewIR(std::span<const float>(ir).first(ir.size() - (size_t) numDropped));
+
+                for(auto* engine : {&third, &reference})
+                    engine->setParameters(0.2f, 0.9f, 1.0f);
+
+                expectLessThan(compareEngines(third, reference, blockSize, 20), 1.0e-6, "layout picked by the budget");
+
+                first.release();
+                expectEquals(getBytes(budget.getUsedBytes()),
+                             getBytes(first.getMemoryBytes() + second.getMemoryBytes() + third.getMemoryBytes()), "after release");
+            }
+
+            expectEquals(getBytes(budget.getUsedBytes()), getBytes(0), "every share is handed back");
+
+            //Loads get the partitions the rest of the budget has room for, the samples themselves are only counted
+            {
+                MemoryBudget tight;
+                DynamicConvolverV2 engine, reference;
+                engine.setMemoryBudget(&tight);
+                engine.prepare(blockSize);
+                reference.prepare(blockSize);
+
+                tight.setLimit(tight.getUsedBytes() + ir.size() * sizeof(float) * 3 / 2);
+                engine.loadNewIR(ir);
+                expectLessOrEqual(tight.getUsedBytes(), tight.getLimit(), "a load stays within the budget");
+
+                auto numDropped = engine.getNumDroppedSamples(0);
+                expect(numDropped > 0 && numDropped < static_cast<int>(ir.size()), "the load is cut short rather than refused");
+
+                reference.loadNewIR(std::span<const float>(ir).first(ir.size() - (size_t) numDropped));
+                for(auto* convolver : {&engine, &reference})
+                    convolver->setParameters(0.0f, 1.0f, 1.0f);
+
+                expectLessThan(compareEngines(engine, reference, blockSize, 20), 1.0e-6, "plays what it kept");
+            }
+
+            //Shaping pools are allocated when shaping is first used, so they don't count against the layout prepare() picks
+            {
+                DynamicConvolverV2 flat, shaped;
+                flat.prepare(blockSize);
+
+                budget.setLimit(flat.getMemoryBytes() + flat.getMemoryBytes() / 100);
+                shaped.setMemoryBudget(&budget);
+                shaped.setShaping(200.0f, 5000.0f, 0.0f, 0.0f);
+                shaped.prepare(blockSize);
+
+                expect(shaped.getSpectrumStorage() == DynamicConvolverV2::SpectrumStorage::full, "shaping doesn't force compact spectra");
+                expectEquals(getBytes(budget.getUsedBytes()), getBytes(shaped.getMemoryBytes()), "counted as allocated");
+
+                shaped.updateShaping();
+                expectEquals(getBytes(budget.getUsedBytes()), getBytes(shaped.getMemoryBytes()), "shaped pool counted once built");
+            }
+
+            budget.setLimit(0);
+        }
+
+        beginTest("Window split across scheduler workers");
+        {
+            DSPScheduler scheduler;
+
+            for(auto compact : {false, true})
+            {
+                EngineCase c {128, 128 * 120 + 31, 0.1f, 0.85f, 0.8f};
+                c.compact = compact;
+                c.scheduler = &scheduler;
+                expectLessThan(runCase(c, random, true), compact ? 2.0e-4 : tolerance, c.getName());
+
+                c.reverse = true;
+                expectLessThan(runCase(c, random, true), compact ? 2.0e-4 : tolerance, c.getName());
+            }
+
+            //Several instances on their own host threads, all sharing the same workers
+            constexpr int numInstances = 6;
+            std::vector<double> errors(numInstances, 1.0);
+            std::vector<std::thread> hostThreads;
+
+            for(auto i = 0; i < numInstances; ++i)
+            {
+                hostThreads.emplace_back([&scheduler, &errors, i]
+                {
+                    juce::Random threadRandom(1000 + i);
+                    EngineCase c {64 << (i % 3), 20000 + 997 * i, 0.05f * i, 0.7f, 1.0f};
+                    c.scheduler = &scheduler;
+                    errors[i] = runCase(c, threadRandom, true);
+                });
+            }
+
+            for(auto& thread : hostThreads)
+                thread.join();
+
+            for(auto i = 0; i < numInstances; ++i)
+                expectLessThan(errors[i], tolerance, "concurrent instance " + juce::String(i));
+        }
+
+        beginTest("Reloads swap in whole");
+        {
+            constexpr int blockSize = 128;
+
+            //Same length, so the same gain, the second is twice the first
+            std::vector<float> irA(blockSize * 8);
+            for(auto& sample : irA)
+                sample = 0.5f + 0.5f * random.nextFloat();
+
+            auto irB = irA;
+            for(auto& sample : irB)
+                sample *= 2.0f;
+
+            DynamicConvolverV2 engine;
+            engine.prepare(blockSize);
+            engine.setParameters(0.0f, 1.0f, 1.0f);
+            engine.loadNewIR(irA);
+
+            //With a constant input the output settles on either IR's sum, a slot that's rebuilt in place drops out
+            std::vector<float> block(blockSize);
+            for(auto i = 0; i < 16; ++i)
+            {
+                std::fill(block.begin(), block.end(), 1.0f);
+                engine.process(block);
+            }
+
+            auto settled = block[0];
+            std::atomic<bool> loading {true};
+            std::thread loader([&]
+            {
+                for(auto i = 0; i < 200; ++i)
+                    engine.loadNewIR(i % 2 == 0 ? irB : irA);
+
+                loading.store(false);
+            });
+
+            auto lowest = settled, highest = settled;
+            while(loading.load())
+            {
+                std::fill(block.begin(), block.end(), 1.0f);
+                engine.process(block);
+
+                for(auto sample : block)
+                {
+                    lowest = std::min(lowest, sample);
+                    highest = std::max(highest, sample);
+                }
+            }
+
+            loader.join();
+            expectGreaterThan(lowest, settled * 0.999f, "never less than the first IR");
+            expectLessThan(highest, settled * 2.001f, "never more than the second");
+        }
+
+        beginTest("Stored slots sized to their IR");
+        {
+            constexpr int blockSize = 512;
+            auto partitionBytes = static_cast<juce::int64>((blockSize * 2 + 2) * sizeof(float));
+            auto getGrowth = [](size_t bytes, size_t before) { return static_cast<juce::int64>(bytes) - static_cast<juce::int64>(before); };
+
+            //Nothing loaded holds the window edges and the spare reserved for captures
+            DynamicConvolverV2 engine;
+            engine.prepare(blockSize);
+            auto empty = engine.getSpectrumMemoryBytes();
+            expectLessThan(getGrowth(empty, 0), partitionBytes * (DynamicConvolverV2::maxPartitions + 20), "an empty engine");
+
+            engine.loadNewIR(makeNoise(random, blockSize * 10));
+            expectEquals(getGrowth(engine.getSpectrumMemoryBytes(), empty), partitionBytes * 10, "a load adds its partitions");
+
+            engine.loadNewIR(makeNoise(random, blockSize * 300), 1);
+            engine.loadNewIR(makeNoise(random, blockSize * 4 - 10), 1);
+            expectEquals(getGrowth(engine.getSpectrumMemoryBytes(), empty), partitionBytes * 14, "a shorter reload hands the rest back");
+
+            //Recorded into the reserved spare, and moved into a slot its size once committed
+            expect(engine.beginCapture(2));
+            auto input = makeNoise(random, blockSize * 20);
+            engine.captureBlock(input);
+            engine.endCapture();
+            engine.commitCapture();
+            expectEquals(getGrowth(engine.getSpectrumMemoryBytes(), empty), partitionBytes * 34, "a committed capture");
+            expect(engine.beginCapture(3), "the spare is reserved for the next capture");
+        }
+
+        beginTest("Sidechain capture");
+        {
+            constexpr int blockSize = 256;
+            auto ir = makeNoise(random, blockSize * 10 + 40, 3.0f);
+
+            DynamicConvolverV2 captured, reference;
+            captured.prepare(blockSize);
+            captured.setParameters(0.0f, 1.0f, 1.0f);
+            reference.setParameters(0.0f, 1.0f, 1.0f);
+
+            //Host blocks that don't line up with the partitions
+            expect(captured.beginCapture(0));
+            auto captureUpTo = [&captured, &ir](size_t& position, size_t end)
+            {
+                for(; position < end; position += std::min<size_t>(100, end - position))
+                    captured.captureBlock(std::span<const float>(ir.data() + position, std::min<size_t>(100, end - position)));
+            };
+
+            //While running, only the completed partitions are heard
+            size_t position = 0;
+            captureUpTo(position, blockSize * 5 + 3);
+            auto other = makeNoise(random, blockSize * 3);
+            expect(!captured.loadNewIR(other, 0), "a slot being captured refuses loads");
+            expect(captured.loadNewIR(other, 1), "other slots still load");
+
+            reference.prepare(blockSize);
+            reference.loadNewIR(std::span<const float>(ir.data(), blockSize * 5));
+            expectLessThan(compareEngines(captured, reference, blockSize, 20), 1.0e-5, "capture in progress");
+
+            captureUpTo(position, ir.size());
+            captured.endCapture();
+            expect(!captured.beginCapture(1), "a capture can't start before the last one is committed");
+            expect(!captured.loadNewIR(other, 0), "nor can a load replace it");
+
+            reference.prepare(blockSize);
+            reference.loadNewIR(ir);
+            expectLessThan(compareEngines(captured, reference, blockSize, 20), 1.0e-5, "finished capture");
+
+            //Committed capture is re-partitioned like a loaded file
+            captured.commitCapture();
+            expect(captured.getIRData(0) == ir, "the capture is kept as the slot's samples");
+            captured.prepare(blockSize / 2);
+            reference.prepare(blockSize / 2);
+            expectLessThan(compareEngines(captured, reference, blockSize / 2, 40), 1.0e-5, "after prepare");
+            expect(captured.loadNewIR(other, 0), "loads go through once it's committed");
+
+            //A load that got past its check just before a capture started must not replace the capture
+            for(auto attempt = 0; attempt < 20; ++attempt)
+            {
+                std::atomic<bool> isLoading {true};
+                std::thread loader([&]
+                {
+                    while(isLoading.load())
+                        captured.loadNewIR(other, 0);
+                });
+
+                while(!captured.beginCapture(0))
+                    std::this_thread::yield();
+
+                isLoading.store(false);
+                loader.join();
+
+                for(size_t position = 0; position < ir.size(); position += 100)
+                    captured.captureBlock(std::span<const float>(ir.data() + position, std::min<size_t>(100, ir.size() - position)));
+
+                captured.endCapture();
+                captured.commitCapture();
+                captured.reset();
+                reference.reset();
+                expectLessThan(compareEngines(captured, reference, blockSize / 2, 40), 1.0e-5, "capture started during loads");
+            }
+        }
+
+        beginTest("Offline partitions on the realtime window grid");
+        {
+            constexpr int gridSize = 256;
+            auto irA = makeNoise(random, gridSize * 37 + 11, 3.0f);
+            auto irB = makeNoise(random, gridSize * 21 + 100, 2.0f);
+
+            struct GridCase
+            {
+                float filePos, fileLen, morph;
+                bool reverse;
+            };
+
+            const GridCase cases[] =
+            {
+                {0.0f, 1.0f, 0.0f, false},
+                {0.3f, 0.5f, 0.0f, false},
+                {0.3f, 0.5f, 0.0f, true},
+                {0.0f, 1.0f, 0.0f, true},
+                {0.2f, 0.6f, 0.4f, false},
+                {0.6f, 0.9f, 0.7f, true},
+            };
+
+            for(auto offlineSize : {2048, 4096})
+            {
+                DynamicConvolverV2 offline, reference;
+                offline.setWindowGrid(gridSize);
+                offline.prepare(offlineSize, (DynamicConvolverV2::maxPartitions * gridSize + offlineSize - 1) / offlineSize);
+                reference.prepare(gridSize);
+
+                for(auto* engine : {&offline, &reference})
+                {
+                    engine->loadNewIR(irA, 0);
+                    engine->loadNewIR(irB, 1);
+                }
+
+                //Same engines throughout, so every case also checks the window is rebuilt when it moves
+                for(auto& g : cases)
+                {
+                    for(auto* engine : {&offline, &reference})
+                    {
+                        engine->setParameters(g.filePos, g.fileLen, 1.0f);
+                        engine->setMorph(0, 1, g.morph);
+                        engine->setReverse(g.reverse);
+
+                        //Longer windows than the flush in compareEngines would still hear the last case
+                        engine->reset();
+                    }
+
+                    expectLessThan(compareEngines(offline, reference, gridSize, 96, offlineSize), 1.0e-5,
+                                   "block " + juce::String(offlineSize) + ", pos " + juce::String(g.filePos, 2)
+                                   + ", len " + juce::String(g.fileLen, 2) + (g.reverse ? ", reversed" : ""));
+                }
+            }
+
+            //An IR longer than the realtime engine holds is cut at the same sample, and reported the same
+            {
+                constexpr int offlineSize = 2048;
+                auto longIR = makeNoise(random, gridSize * (DynamicConvolverV2::maxPartitions + 3) + 7, 3.0f);
+
+                DynamicConvolverV2 offline, reference;
+                offline.setWindowGrid(gridSize);
+                offline.prepare(offlineSize, (DynamicConvolverV2::maxPartitions * gridSize + offlineSize - 1) / offlineSize);
+                reference.prepare(gridSize);
+
+                for(auto* engine : {&offline, &reference})
+                    engine->loadNewIR(longIR);
+
+                expectGreaterThan(reference.getNumDroppedSamples(0), 0);
+                expectEquals(offline.getNumDroppedSamples(0), reference.getNumDroppedSamples(0), "grid engines report what they cut");
+            }
+        }
+
+        beginTest("Spectral IR shaping");
+        {
+            constexpr int blockSize = 256;
+            constexpr int numBlocks = 48;
+            auto ir = makeNoise(random, blockSize * 40, 1.0f);
+            auto otherIR = makeNoise(random, blockSize * 25, 2.0f);
+
+            for(auto storage : {DynamicConvolverV2::SpectrumStorage::full, DynamicConvolverV2::SpectrumStorage::compact})
+            {
+                auto name = juce::String(storage == DynamicConvolverV2::SpectrumStorage::full ? "full" : "compact");
+
+                DynamicConvolverV2 shaped, plain, reference;
+                for(auto* engine : {&shaped, &plain, &reference})
+                {
+                    engine->setSpectrumStorage(storage);
+                    engine->setSampleRate(shapingSampleRate);
+                    engine->prepare(blockSize);
+                    engine->setParameters(0.0f, 1.0f, 1.0f);
+                    engine->loadNewIR(ir);
+                }
+
+                //The unshaped spectra keep playing until the shaped ones are swapped in
+                shaped.setShaping(20.0f, 1000.0f, 0.0f, 0.0f);
+                expectLessThan(compareEngines(shaped, plain, blockSize, 20), 1.0e-6, name + ", before the swap");
+                expect(shaped.updateShaping(), name + ", shaped");
+                expect(!shaped.updateShaping(), name + ", nothing left to shape");
+
+                auto plainResponse = getImpulseResponse(plain, blockSize, numBlocks);
+                auto response = getImpulseResponse(shaped, blockSize, numBlocks);
+                expectWithinAbsoluteError(getBandGain(response, plainResponse, 100.0, 300.0), 1.0, 0.05, name + ", high cut passband");
+                expectLessThan(getBandGain(response, plainResponse, 7000.0, 9000.0), 0.03, name + ", high cut stopband");
+
+                shaped.setShaping(500.0f, 20000.0f, 0.0f, 0.0f);
+                shaped.updateShaping();
+                response = getImpulseResponse(shaped, blockSize, numBlocks);
+                expectLessThan(getBandGain(response, plainResponse, 100.0, 180.0), 0.3, name + ", low cut stopband");
+                expectWithinAbsoluteError(getBandGain(response, plainResponse, 4000.0, 6000.0), 1.0, 0.05, name + ", low cut passband");
+
+                //3 dB per octave, two octaves up and one down from the pivot
+                //The curve is only as fine as the partition's bins, so the lows are checked loosely
+                shaped.setShaping(20.0f, 20000.0f, 3.0f, 0.0f);
+                shaped.updateShaping();
+                response = getImpulseResponse(shaped, blockSize, numBlocks);
+                expectWithinAbsoluteError(getBandGain(response, plainResponse, 3500.0, 4500.0), 2.0, 0.15, name + ", tilt up");
+                expectWithinAbsoluteError(getBandGain(response, plainResponse, 400.0, 600.0), 0.72, 0.12, name + ", tilt down");
+
+                //Damping darkens the tail more than the start
+                shaped.setShaping(20.0f, 20000.0f, 0.0f, 1.0f);
+                shaped.updateShaping();
+                response = getImpulseResponse(shaped, blockSize, numBlocks);
+                auto early = getBandGain(response, plainResponse, 8000.0, 12000.0, 0, blockSize * 8);
+                auto late = getBandGain(response, plainResponse, 8000.0, 12000.0, blockSize * 30, blockSize * 40);
+                expectGreaterThan(early, 0.9, name + ", damping start");
+                expectLessThan(late, early * 0.7, name + ", damping tail");
+
+                //IRs loaded while shaped go straight into the shaped spectra
+                shaped.setShaping(20.0f, 1000.0f, 2.0f, 0.5f);
+                shaped.updateShaping();
+                shaped.loadNewIR(otherIR);
+                reference.loadNewIR(otherIR);
+                reference.setShaping(20.0f, 1000.0f, 2.0f, 0.5f);
+                reference.updateShaping();
+                shaped.reset();
+                reference.reset();
+                expectLessThan(compareEngines(shaped, reference, blockSize, 20), 1.0e-5, name + ", load while shaped");
+
+                //Flat again, back to the source spectra
+                shaped.setShaping(20.0f, 20000.0f, 0.0f, 0.0f);
+                shaped.updateShaping();
+                plain.loadNewIR(otherIR);
+                shaped.reset();
+                plain.reset();
+                expectLessThan(compareEngines(shaped, plain, blockSize, 20), 1.0e-6, name + ", flat");
+            }
+        }
+
+        beginTest("Capture while shaped");
+        {
+            constexpr int blockSize = 256;
+            auto ir = makeNoise(random, blockSize * 12 + 40, 2.0f);
+
+            DynamicConvolverV2 captured, reference, empty;
+            for(auto* engine : {&captured, &reference, &empty})
+            {
+                engine->setSampleRate(shapingSampleRate);
+                engine->prepare(blockSize);
+                engine->setParameters(0.0f, 1.0f, 1.0f);
+                engine->setShaping(20.0f, 1000.0f, 2.0f, 0.5f);
+                engine->updateShaping();
+            }
+
+            //The audio thread only records, the captured partitions play once the shaper has caught up with them
+            expect(captured.beginCapture(0));
+            for(size_t position = 0; position < ir.size(); position += 100)
+                captured.captureBlock(std::span<const float>(ir.data() + position, std::min<size_t>(100, ir.size() - position)));
+
+            expectLessThan(compareEngines(captured, empty, blockSize, 20), 1.0e-6, "played like an empty slot until shaped");
+
+            expect(captured.isShapingCapture());
+            expect(captured.updateShaping(), "the completed partitions are shaped");
+            expect(!captured.updateShaping(), "nothing more until the next one");
+
+            captured.endCapture();
+            expect(captured.updateShaping(), "the last partition once it has ended");
+
+            reference.loadNewIR(ir);
+            expectLessThan(compareEngines(captured, reference, blockSize, 20), 1.0e-5, "ended");
+
+            captured.commitCapture();
+            expect(!captured.isShapingCapture());
+            expectLessThan(compareEngines(captured, reference, blockSize, 20), 1.0e-5, "committed");
+        }
+
+        beginTest("Shaped output doesn't depend on where a block starts");
+        {
+            constexpr int blockSize = 64;
+            constexpr int numBlocks = 40;
+            constexpr int offset = 37;
+            auto ir = makeNoise(random, blockSize * 30, 2.0f);
+
+            for(auto storage : {DynamicConvolverV2::SpectrumStorage::full, DynamicConvolverV2::SpectrumStorage::compact})
+            {
+                auto name = juce::String(storage == DynamicConvolverV2::SpectrumStorage::full ? "full" : "compact");
+
+                DynamicConvolverV2 engine;
+                engine.setSpectrumStorage(storage);
+                engine.setSampleRate(shapingSampleRate);
+                engine.prepare(blockSize);
+                engine.setParameters(0.0f, 1.0f, 1.0f);
+                engine.loadNewIR(ir);
+                engine.setShaping(20.0f, 1000.0f, 0.0f, 0.5f);
+                engine.updateShaping();
+
+                //Same impulse, once on a block boundary and once partway into a block
+                auto response = getImpulseResponse(engine, blockSize, numBlocks);
+
+                std::vector<float> shifted(static_cast<size_t>(numBlocks * blockSize), 0.0f);
+                shifted[offset] = 1.0f;
+                engine.reset();
+                for(auto block = 0; block < numBlocks; ++block)
+                    engine.process(std::span<float>(shifted.data() + block * blockSize, static_cast<size_t>(blockSize)));
+
+                double peak = 1.0e-9, maxError = 0.0;
+                for(size_t i = 0; i + offset < shifted.size(); ++i)
+                {
+                    peak = std::max(peak, (double) std::abs(response[i]));
+                    maxError = std::max(maxError, (double) std::abs(response[i] - shifted[i + offset]));
+                }
+
+                //Compact rounding isn't confined to the partition's samples, so it's only as exact as the other compact cases
+                expectLessThan(maxError / peak, storage == DynamicConvolverV2::SpectrumStorage::full ? 1.0e-5 : 2.0e-4, name);
+            }
+        }
+
+        beginTest("Shaping swapped in under a running engine");
+        {
+            constexpr int blockSize = 128;
+            auto ir = makeNoise(random, blockSize * 300, 3.0f);
+
+            DynamicConvolverV2 engine, reference;
+            for(auto* e : {&engine, &reference})
+            {
+                e->setSampleRate(shapingSampleRate);
+                e->prepare(blockSize);
+                e->setParameters(0.0f, 1.0f, 1.0f);
+                e->loadNewIR(ir);
+            }
+
+            SpectrumShaper shaper;
+            shaper.addEngine(&engine);
+
+            //Knob sweep while the audio keeps running, every pass races the blocks
+            auto input = makeNoise(random, blockSize);
+            for(auto block = 0; block < 400; ++block)
+            {
+                engine.setShaping(20.0f + block * 2.0f, 20000.0f - block * 40.0f, -2.0f + block * 0.01f, block / 400.0f);
+                engine.process(input);
+            }
+
+            shaper.removeEngine(&engine);
+            while(engine.updateShaping())
+            {
+            }
+
+            reference.setShaping(20.0f + 399 * 2.0f, 20000.0f - 399 * 40.0f, -2.0f + 399 * 0.01f, 399 / 400.0f);
+            reference.updateShaping();
+            engine.reset();
+            expectLessThan(compareEngines(engine, reference, blockSize, 40), 1.0e-6, "after the sweep");
+        }
+
+        beginTest("Fed history");
+        {
+            //The fed stretch starts and ends inside a block, and the window holds still around it
+            constexpr int blockSize = 256, numSamples = 14000;
+            constexpr int steadyStart = 5000, feedStart = 5300, feedEnd = 8700, steadyEnd = 9000;
+            auto ir = makeNoise(random, 20000, 3.0f);
+
+            DynamicConvolverV2 played, fed;
+            for(auto* e : {&played, &fed})
+            {
+                e->prepare(blockSize);
+                e->loadNewIR(ir);
+            }
+
+            auto input = makeNoise(random, numSamples);
+            auto playedOutput = input, fedOutput = input;
+
+            DynamicConvolverV2::WindowParameters steady;
+            steady.filePos = 0.1f;
+            steady.fileLen = 0.6f;
+
+            for(auto position = 0; position < numSamples;)
+            {
+                //Calls of any length, cut where the feed starts and ends
+                auto end = std::min(numSamples, position + 1 + random.nextInt(300));
+                for(auto boundary : {feedStart, feedEnd})
+                    if(position < boundary && end > boundary)
+                        end = boundary;
+
+                auto parameters = steady;
+                if(position < steadyStart || position >= steadyEnd)
+                    parameters.filePos = 0.3f * random.nextFloat();
+
+                auto numToProcess = static_cast<size_t>(end - position);
+                played.process(std::span<float>(playedOutput.data() + position, numToProcess), parameters);
+
+                if(position >= feedStart && position < feedEnd)
+                    fed.feedHistory(std::span<const float>(input.data() + position, numToProcess), parameters);
+                else
+                    fed.process(std::span<float>(fedOutput.data() + position, numToProcess), parameters);
+
+                position = end;
+            }
+
+            double peak = 1.0e-9, maxError = 0.0;
+            for(auto i = 0; i < numSamples; ++i)
+            {
+                if(i >= feedStart && i < feedEnd)
+                    continue;
+
+                peak = std::max(peak, (double) std::abs(playedOutput[i]));
+                maxError = std::max(maxError, (double) std::abs(fedOutput[i] - playedOutput[i]));
+            }
+
+            expectLessThan(maxError / peak, 1.0e-5, "carries on as if it had played");
+        }
+    }
+
+private:
+    //Feeds both engines the same noise, returns the largest difference relative to the peak output
+    //Leading silence flushes whatever either engine still holds from earlier blocks
+    //a runs blocks of blockSizeA when it's prepared differently, numBlocks * blockSize must be a multiple of it
+    double compareEngines(DynamicConvolverV2& a, DynamicConvolverV2& b, int blockSize, int numBlocks, int blockSizeA = 0)
+    {
+        constexpr int numSilentBlocks = 24;
+        blockSizeA = blockSizeA > 0 ? blockSizeA : blockSize;
+
+        auto processBlocks = [](DynamicConvolverV2& engine, std::vector<float>& data, int size)
+        {
+            for(size_t position = 0; position < data.size(); position += static_cast<size_t>(size))
+                engine.process(std::span<float>(data.data() + position, static_cast<size_t>(size)));
+        };
+
+        std::vector<float> silenceA(static_cast<size_t>(numSilentBlocks * blockSizeA));
+        std::vector<float> silenceB(static_cast<size_t>(numSilentBlocks * blockSize));
+        processBlocks(a, silenceA, blockSizeA);
+        processBlocks(b, silenceB, blockSize);
+
+        auto input = makeNoise(random, numBlocks * blockSize);
+        auto outputA = input;
+        auto outputB = input;
+
+        processBlocks(a, outputA, blockSizeA);
+        processBlocks(b, outputB, blockSize);
+
+        double peak = 1.0e-9, maxError = 0.0;
+        for(size_t i = 0; i < outputB.size(); ++i)
+        {
+            peak = std::max(peak, (double) std::abs(outputB[i]));
+            maxError = std::max(maxError, (double) std::abs(outputA[i] - outputB[i]));
+        }
+
+        return maxError / peak;
+    }
+
+    static constexpr double shapingSampleRate = 48000.0;
+
+    //Wet response of the engine to a unit impulse, from an empty history
+    std::vector<float> getImpulseResponse(DynamicConvolverV2& engine, int blockSize, int numBlocks)
+    {
+        std::vector<float> response(static_cast<size_t>(numBlocks * blockSize), 0.0f);
+        response[0] = 1.0f;
+
+        engine.reset();
+        for(auto block = 0; block < numBlocks; ++block)
+            engine.process(std::span<float>(response.data() + block * blockSize, static_cast<size_t>(blockSize)));
+
+        return response;
+    }
+
+    //Magnitude of a against b over a band, from the energy of both at a handful of frequencies
+    //end = 0 uses the whole response
+    double getBandGain(const std::vector<float>& a, const std::vector<float>& b, double lowHz, double highHz,
+                       size_t start = 0, size_t end = 0)
+    {
+        constexpr int numFrequencies = 24;
+        end = end > 0 ? end : a.size();
+        double energyA = 0.0, energyB = 0.0;
+
+        for(auto i = 0; i < numFrequencies; ++i)
+        {
+            auto hz = lowHz + (highHz - lowHz) * i / (numFrequencies - 1);
+            auto omega = juce::MathConstants<double>::twoPi * hz / shapingSampleRate;
+            std::complex<double> sumA, sumB;
+
+            for(auto n = start; n < end; ++n)
+            {
+                auto rotation = std::polar(1.0, -omega * static_cast<double>(n));
+                sumA += static_cast<double>(a[n]) * rotation;
+                sumB += static_cast<double>(b[n]) * rotation;
+            }
+
+            energyA += std::norm(sumA);
+            energyB += std::norm(sumB);
+        }
+
+        return std::sqrt(energyA / std::max(energyB, 1.0e-20));
+    }
+
+    double runMorphCase(const EngineCase& a, const EngineCase& b, float morph)
+    {
+        auto irA = makeNoise(random, a.irLength, 6.0f);
+        auto irB = makeNoise(random, b.irLength, 6.0f);
+
+        float gainA = 1.0f, gainB = 1.0f;
+        auto windowA = getWindow(irA, a, gainA);
+        auto windowB = getWindow(irB, b, gainB);
+
+        auto numBlocks = static_cast<int>(std::max(windowA.size(), windowB.size())) / a.blockSize + 4;
+        auto input = makeNoise(random, numBlocks * a.blockSize);
+
+        DynamicConvolverV2 engine;
+        engine.prepare(a.blockSize);
+        engine.loadNewIR(irA, 0);
+        engine.loadNewIR(irB, 1);
+        engine.setParameters(a.filePos, a.fileLen, 1.0f);
+        engine.setMorph(0, 1, morph);
+
+        auto output = input;
+        for(auto block = 0; block < numBlocks; ++block)
+            engine.process(std::span<float>(output.data() + block * a.blockSize, static_cast<size_t>(a.blockSize)));
+
+        auto referenceA = directConvolution(input, windowA, gainA, 1.0f);
+        auto referenceB = directConvolution(input, windowB, gainB, 1.0f);
+
+        double peak = 1.0e-9, maxError = 0.0;
+        for(size_t i = 0; i < output.size(); ++i)
+        {
+            auto reference = (1.0 - morph) * referenceA[i] + morph * referenceB[i];
+            peak = std::max(peak, std::abs(reference));
+            maxError = std::max(maxError, std::abs(output[i] - reference));
+        }
+
+        return maxError / peak;
+    }
+
+    juce::Random random {0x5eed};
+};
+
+static EngineAccuracyTests engineAccuracyTests;
+
+//==============================================================================
+namespace
+{
+    //Just enough of a plugin to own the parameters the effect reads
+    class TestProcessor : public juce::AudioProcessor
+    {
+    public:
+        TestProcessor() : parameters(*this, nullptr, "PARAMETERS", DynamicConvolutionEffect::createParameterLayout()) {}
+
+        const juce::String getName() const override { return "Effect tests"; }
+        void prepareToPlay(double, int) override {}
+        void releaseResources() override {}
+        void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override {}
+        double getTailLengthSeconds() const override { return 0.0; }
+        bool acceptsMidi() const override { return false; }
+        bool producesMidi() const override { return false; }
+        juce::AudioProcessorEditor* createEditor() override { return nullptr; }
+        bool hasEditor() const override { return false; }
+        int getNumPrograms() override { return 1; }
+        int getCurrentProgram() override { return 0; }
+        void setCurrentProgram(int) override {}
+        const juce::String getProgramName(int) override { return {}; }
+        void changeProgramName(int, const juce::String&) override {}
+        void getStateInformation(juce::MemoryBlock&) override {}
+        void setStateInformation(const void*, int) override {}
+
+        //In the parameter's own units, as a host would automate it
+        void setParameter(const juce::String& parameterID, float value)
+        {
+            auto* parameter = parameters.getParameter(parameterID);
+            parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+        }
+
+        juce::AudioProcessorValueTreeState parameters;
+    };
+
+    std::shared_ptr<const LoadedIR> makeLoadedIR(const std::vector<float>& samples)
+    {
+        auto ir = std::make_shared<LoadedIR>();
+        ir->sampleRate = sampleRate;
+        ir->buffer.setSize(1, static_cast<int>(samples.size()));
+        ir->buffer.copyFrom(0, 0, samples.data(), static_cast<int>(samples.size()));
+        return ir;
+    }
+
+    //Runs the message loop, where the effect hands loads over and commits captures, until condition holds
+    bool dispatchUntil(const std::function<bool()>& condition, int timeoutMs = 10000)
+    {
+        for(auto waited = 0; !condition(); waited += 5)
+        {
+            if(waited >= timeoutMs)
+                return false;
+
+            juce::MessageManager::getInstance()->runDispatchLoopUntil(5);
+        }
+
+        return true;
+    }
+
+    //One host block, the input is sent to both channels and the left output is written back over it
+    //The sidechain is left disconnected when there's none
+    void processEffectBlock(DynamicConvolutionEffect& effect, float* samples, int numSamples, float* sidechain = nullptr)
+    {
+        std::vector<float> right(samples, samples + numSamples);
+        float* channels[] = {samples, right.data()};
+
+        if(sidechain != nullptr)
+            effect.processBlock(juce::AudioBuffer<float>(channels, 2, numSamples), juce::AudioBuffer<float>(&sidechain, 1, numSamples));
+        else
+            effect.processBlock(juce::AudioBuffer<float>(channels, 2, numSamples), juce::AudioBuffer<float>());
+    }
+}
+
+//==============================================================================
+class EffectTests : public juce::UnitTest
+{
+public:
+    EffectTests() : juce::UnitTest("Effect", "DynamicConvolver") {}
+
+    void runTest() override
+    {
+        beginTest("Block size change");
+        {
+            constexpr int oldBlockSize = 256, newBlockSize = 512;
+            auto ir = makeNoise(random, 24000, 3.0f);
+
+            TestProcessor processor;
+            DynamicConvolutionEffect effect(processor.parameters);
+            effect.prepare(sampleRate, oldBlockSize);
+
+            auto loadedIR = makeLoadedIR(ir);
+            effect.loadIR(loadedIR, 0);
+            expect(dispatchUntil([&] { return effect.getSlotIR(0) == loadedIR; }), "IR loaded");
+
+            //Same defaults as the parameters, prepared once
+            DynamicConvolverV2 reference;
+            reference.prepare(oldBlockSize);
+            reference.setParameters(0.0f, 1.0f, 0.5f);
+            reference.loadNewIR(ir);
+
+            auto output = makeNoise(random, oldBlockSize * 16);
+            auto expected = output;
+
+            for(auto position = 0; position < static_cast<int>(output.size()); position += oldBlockSize)
+            {
+                processEffectBlock(effect, output.data() + position, oldBlockSize);
+                reference.process(std::span<float>(expected.data() + position, oldBlockSize));
+            }
+
+            //prepare() drops the history, like any host restarting playback
+            auto bytesBefore = effect.getMemoryBytes();
+            effect.prepare(sampleRate, newBlockSize);
+            reference.reset();
+
+            //Long enough for the new pair to be built, swapped in, and for the old one to ring out and be released
+            auto maxBytes = bytesBefore;
+            double peak = 1.0e-9, maxError = 0.0;
+
+            for(auto block = 0; block < 200; ++block)
+            {
+                auto input = makeNoise(random, newBlockSize);
+                auto result = input;
+
+                processEffectBlock(effect, result.data(), newBlockSize);
+                reference.process(std::span<float>(input));
+
+                for(auto i = 0; i < newBlockSize; ++i)
+                {
+                    peak = std::max(peak, (double) std::abs(input[i]));
+                    maxError = std::max(maxError, (double) std::abs(result[i] - input[i]));
+                }
+
+                juce::MessageManager::getInstance()->runDispatchLoopUntil(1);
+                maxBytes = std::max(maxBytes, effect.getMemoryBytes());
+            }
+
+            expectLessThan(maxError / peak, 1.0e-5, "output across the swap");
+
+            //Two pairs were held while the new one was built, and only the one playing is left
+            expectGreaterThan(maxBytes, bytesBefore, "new pair built");
+            expect(dispatchUntil([&] { return effect.getMemoryBytes() < maxBytes; }), "old pair released");
+        }
+
+        beginTest("Load during a capture");
+        {
+            constexpr int blockSize = 512;
+            auto firstIR = makeLoadedIR(makeNoise(random, 8192, 3.0f));
+            auto secondIR = makeLoadedIR(makeNoise(random, 8192, 3.0f));
+
+            TestProcessor processor;
+            DynamicConvolutionEffect effect(processor.parameters);
+            effect.prepare(sampleRate, blockSize);
+            effect.loadIR(firstIR, 0);
+            expect(dispatchUntil([&] { return effect.getSlotIR(0) == firstIR; }), "first IR loaded");
+
+            //Slot A is slot 0 by default
+            processor.setParameter("CAPTURE", 1.0f);
+            auto input = makeNoise(random, blockSize);
+            auto sidechain = makeNoise(random, blockSize);
+
+            for(auto block = 0; block < 8; ++block)
+            {
+                auto output = input;
+                processEffectBlock(effect, output.data(), blockSize, sidechain.data());
+            }
+
+            //Refused while the capture runs, it waits rather than being lost
+            effect.loadIR(secondIR, 0);
+            juce::MessageManager::getInstance()->runDispatchLoopUntil(100);
+            expect(effect.getSlotIR(0) == firstIR, "slot kept while capturing");
+
+            processor.setParameter("CAPTURE", 0.0f);
+            auto output = input;
+            processEffectBlock(effect, output.data(), blockSize, sidechain.data());
+            expect(dispatchUntil([&] { return effect.getSlotIR(0) == secondIR; }), "load applied after the commit");
+
+            DynamicConvolverV2 reference;
+            reference.prepare(blockSize);
+            reference.setParameters(0.0f, 1.0f, 0.5f);
+            reference.loadNewIR(std::span<const float>(secondIR->buffer.getReadPointer(0), secondIR->buffer.getNumSamples()));
+
+            //Silence first, so the effect's history from the capture has played out
+            for(auto block = 0; block < 32; ++block)
+            {
+                std::vector<float> silence(blockSize);
+                processEffectBlock(effect, silence.data(), blockSize);
+            }
+
+            double peak = 1.0e-9, maxError = 0.0;
+            for(auto block = 0; block < 32; ++block)
+            {
+                auto expected = makeNoise(random, blockSize);
+                auto result = expected;
+
+                processEffectBlock(effect, result.data(), blockSize);
+                reference.process(std::span<float>(expected));
+
+                for(auto i = 0; i < blockSize; ++i)
+                {
+                    peak = std::max(peak, (double) std::abs(expected[i]));
+                    maxError = std::max(maxError, (double) std::abs(result[i] - expected[i]));
+                }
+            }
+
+            expectLessThan(maxError / peak, 1.0e-5, "plays the IR loaded during the capture");
+        }
+
+        beginTest("Offline render under automation");
+        {
+            //Calls that don't divide the blocks or the offline partitions, so both are split mid call
+            constexpr int blockSize = 512, callSize = 384, numCalls = 320;
+            constexpr int latency = DynamicConvolutionEffect::offlinePartitionSize;
+            auto loadedIR = makeLoadedIR(makeNoise(random, 24000, 3.0f));
+
+            //Both read the same parameters, so they hear the same automation
+            TestProcessor processor;
+            DynamicConvolutionEffect realtime(processor.parameters), offline(processor.parameters);
+            realtime.prepare(sampleRate, blockSize);
+            offline.prepare(sampleRate, blockSize, true);
+            expectEquals(offline.getLatencySamples(), latency, "reported latency");
+
+            realtime.loadIR(loadedIR, 0);
+            offline.loadIR(loadedIR, 0);
+            expect(dispatchUntil([&] { return realtime.getSlotIR(0) == loadedIR && offline.getSlotIR(0) == loadedIR; }), "IR loaded");
+
+            processor.setParameter("FILE_LEN", 0.5f);
+            auto input = makeNoise(random, numCalls * callSize);
+            auto realtimeOutput = input, offlineOutput = input;
+
+            //The window holds still for several partitions, steps, and moves on every call for a while
+            for(auto call = 0; call < numCalls; ++call)
+            {
+                auto isMoving = call >= 170 && call < 200;
+                processor.setParameter("FILE_POS", isMoving ? 0.2f + 0.01f * static_cast<float>(call - 170) : 0.1f * static_cast<float>(call / 80));
+                processor.setParameter("DRY_WET", call % 50 < 25 ? 0.5f : 0.8f);
+
+                processEffectBlock(realtime, realtimeOutput.data() + call * callSize, callSize);
+                processEffectBlock(offline, offlineOutput.data() + call * callSize, callSize);
+            }
+
+            double peak = 1.0e-9, maxError = 0.0;
+            for(size_t i = 0; i + latency < input.size(); ++i)
+            {
+                peak = std::max(peak, (double) std::abs(realtimeOutput[i]));
+                maxError = std::max(maxError, (double) std::abs(offlineOutput[i + latency] - realtimeOutput[i]));
+            }
+
+            expectLessThan(maxError / peak, 1.0e-4, "offline output, delayed by the latency");
+        }
+    }
+
+private:
+    juce::Random random {0xeffec7};
+};
+
+static EffectTests effectTests;
+
+//==============================================================================
+class EnginePerformanceTests : public juce::UnitTest
+{
+public:
+    EnginePerformanceTests() : juce::UnitTest("Engine performance", "DynamicConvolver") {}
+
+    void runTest() override
+    {
+        beginTest("Long IR, realtime block sizes");
+        {
+            for(auto blockSize : {128, 256, 512, 1024})
+            {
+                EngineCase c;
+                c.blockSize = blockSize;
+                c.irLength = std::min(400 * blockSize, static_cast<int>(sampleRate * 2.0));
+                c.numBlocks = 2000;
+                runCase(c, random, false);
+
+                c.compact = true;
+                runCase(c, random, false);
+            }
+        }
+
+        beginTest("Long IR, scheduled");
+        {
+            DSPScheduler scheduler;
+
+            for(auto blockSize : {128, 512})
+            {
+                EngineCase c;
+                c.blockSize = blockSize;
+                c.irLength = std::min(400 * blockSize, static_cast<int>(sampleRate * 2.0));
+                c.numBlocks = 2000;
+                c.scheduler = &scheduler;
+                runCase(c, random, false);
+            }
+        }
+
+        beginTest("Long IR, offline partitions");
+        {
+            //The longest IR of a 256 sample realtime engine, in the offline partition size
+            EngineCase c;
+            c.blockSize = 8192;
+            c.irLength = 400 * 256;
+            c.numBlocks = 100;
+            runCase(c, random, false);
+
+            DSPScheduler scheduler;
+            c.scheduler = &scheduler;
+            runCase(c, random, false);
+        }
+
+        beginTest("Long IR, dense automation");
+        {
+            //Whole blocks against short calls, each with and without the window moving on every call
+            for(auto callSize : {0, 128, 32})
+            {
+                for(auto automate : {false, true})
+                {
+                    EngineCase c;
+                    c.irLength = static_cast<int>(sampleRate * 2.0);
+                    c.fileLen = 0.8f;
+                    c.numBlocks = 500;
+                    c.callSize = callSize;
+                    c.automate = automate;
+                    runCase(c, random, false);
+                }
+            }
+        }
+
+        beginTest("Long IR, offline partitions under automation");
+        {
+            //A bounce of the longest IR a 512 sample engine holds, the window moving on every host block
+            for(auto callSize : {0, 512})
+            {
+                for(auto automate : {false, true})
+                {
+                    EngineCase c;
+                    c.blockSize = 8192;
+                    c.windowGrid = 512;
+                    c.irLength = DynamicConvolverV2::maxPartitions * 512;
+                    c.fileLen = 0.8f;
+                    c.numBlocks = 24;
+                    c.callSize = callSize;
+                    c.automate = automate;
+                    runCase(c, random, false);
+                }
+            }
+        }
+
+        beginTest("Long IR, half window");
+        {
+            EngineCase c;
+            c.irLength = static_cast<int>(sampleRate * 2.0);
+            c.filePos = 0.25f;
+            c.fileLen = 0.5f;
+            c.numBlocks = 2000;
+            runCase(c, random, false);
+        }
+
+        //Keeps the runner happy, the timings are checked against the baseline in main()
+        expect(true);
+    }
+
+private:
+    juce::Random random {0xbe9c};
+};
+
+static EnginePerformanceTests enginePerformanceTests;
+
+
+//==============================================================================
+namespace
+{
+    void writeTimings(const juce::File& file)
+    {
+        juce::String text;
+        text << "# case\tus/block\trealtime factor\tmax error\n";
+
+        for(auto& timing : getTimings())
+            text << timing.name << "\t" << juce::String(timing.microsecondsPerBlock, 3) << "\t"
+                 << juce::String(timing.realtimeFactor, 1) << "\t" << juce::String(timing.maxError, 9) << "\n";
+
+        file.replaceWithText(text);
+    }
+
+    //Returns the number of cases slower than the baseline by more than the tolerance
+    int compareWithBaseline(const juce::File& file, double tolerance)
+    {
+        juce::StringArray lines;
+        lines.addLines(file.loadFileAsString());
+
+        auto numRegressions = 0;
+        for(auto& line : lines)
+        {
+            if(line.startsWith("#") || line.trim().isEmpty())
+                continue;
+
+            juce::StringArray columns;
+            columns.addTokens(line, "\t", {});
+            if(columns.size() < 2)
+                continue;
+
+            auto baselineTime = columns[1].getDoubleValue();
+
+            for(auto& timing : getTimings())
+            {
+                if(timing.name != columns[0] || timing.microsecondsPerBlock <= baselineTime * tolerance)
+                    continue;
+
+                std::cout << "REGRESSION: " << timing.name << " took " << juce::String(timing.microsecondsPerBlock, 3)
+                          << " us/block, baseline " << juce::String(baselineTime, 3) << " us/block\n";
+                ++numRegressions;
+            }
+        }
+
+        return numRegressions;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    juce::ArgumentList args(argc, argv);
+
+    //The engine tests record on this thread
+    DynConvTrace::registerThread();
+
+    //The effect tests run the message loop on this thread, where the effect hands loads over
+    juce::MessageManager::getInstance();
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTestsInCategory("DynamicConvolver");
+
+    auto numFailures = 0;
+    for(auto i = 0; i < runner.getNumResults(); ++i)
+        numFailures += runner.getResult(i)->failures;
+
+    for(auto& timing : getTimings())
+        std::cout << timing.name << ": " << juce::String(timing.microsecondsPerBlock, 3) << " us/block, "
+                  << juce::String(timing.realtimeFactor, 1) << "x realtime\n";
+
+    if(args.containsOption("--bench"))
+        writeTimings(args.getFileForOption("--bench"));
+
+    if(args.containsOption("--trace"))
+        DynConvTrace::exportChromeTrace(args.getFileForOption("--trace"));
+
+    if(args.containsOption("--baseline"))
+    {
+        auto tolerance = args.containsOption("--tolerance") ? args.getValueForOption("--tolerance").getDoubleValue() : 1.25;
+        numFailures += compareWithBaseline(args.getFileForOption("--baseline"), tolerance);
+    }
+
+    juce::MessageManager::deleteInstance();
+    return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,296 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Created: 19 Oct 2026 2:41:07pm
+    Author:  Benjamin Ward
+
+    Offline batch renderer, convolves a list of files with one IR window
+    using the same engine as the plugin. Files are rendered in parallel,
+    each one on its own set of engines, so the output doesn't depend on
+    the number of threads.
+
+  ==============================================================================
+*/
+
+#include "DynamicConvolver.h"
+#include "IRFileLoader.h"
+#include "Trace.h"
+
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <juce_core/juce_core.h>
+
+#include <atomic>
+#include <map>
+#include <span>
+#include <vector>
+
+
+namespace
+{
+    struct RenderSettings
+    {
+        std::shared_ptr<const LoadedIR> ir;
+
+        float filePos = 0.0f;
+        float fileLen = 1.0f;
+        float dryWet = 1.0f;
+
+        int partitionSize = 4096;
+        int windowGrid = 0; //0 = on the partition grid
+        bool compactSpectra = false;
+        bool reverse = false;
+        juce::File outputDir;
+    };
+
+    const char* const usage =
+        "Usage: DynamicConvolverRender --ir=<file> [options] <input files...>\n"
+        "\n"
+        "Options take their value after = or as the next argument, --pos=0.5 or --pos 0.5\n"
+        "\n"
+        "  --ir=<file>         Impulse response to convolve with\n"
+        "  --pos=<0-1>         FILE_POS, start of the IR window (default 0)\n"
+        "  --len=<0-1>         FILE_LEN, length of the IR window (default 1)\n"
+        "  --mix=<0-1>         DRY_WET (default 1)\n"
+        "  --partition=<n>     Internal partition size, power of two (default 4096)\n"
+        "  --grid=<n>          Host block size of a plugin session to match, the window is placed on its grid\n"
+        "  --threads=<n>       Number of files rendered at once (default: all cores)\n"
+        "  --compact           Store the IR spectra as int16, half the memory, more CPU, slightly less accurate\n"
+        "  --reverse           Play the IR window backwards\n"
+        "  --out=<dir>         Output directory (default: next to each input)\n"
+        "  --trace=<file>      Write a Chrome trace of the render (needs a DYNCONV_TRACE build)\n";
+
+    juce::File getOutputFile(const RenderSettings& settings, const juce::File& input)
+    {
+        auto dir = settings.outputDir == juce::File{} ? input.getParentDirectory() : settings.outputDir;
+        return dir.getChildFile(input.getFileNameWithoutExtension() + "_conv.wav");
+    }
+
+    //Renders one file start to finish, returns an empty string on success
+    juce::String renderFile(const RenderSettings& settings, const juce::File& input)
+    {
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(input));
+        if(reader == nullptr)
+            return "could not read " + input.getFullPathName();
+
+        //Like the plugin, the IR is played at the rate of whatever it convolves
+        if(settings.ir->sampleRate != reader->sampleRate)
+            std::cerr << "Warning: " << input.getFileName() << " is at " << juce::String(reader->sampleRate, 0) << " Hz and the IR at "
+                      << juce::String(settings.ir->sampleRate, 0) << " Hz, the IR plays at " << juce::String(reader->sampleRate, 0)
+                      << " Hz, so it sounds pitched and its length changes\n";
+
+        auto& irBuffer = settings.ir->buffer;
+        auto numInputChannels = static_cast<int>(reader->numChannels);
+        auto numChannels = std::max(numInputChannels, irBuffer.getNumChannels());
+        auto inputLength = static_cast<int>(reader->lengthInSamples);
+        auto blockSize = settings.partitionSize;
+
+        //Output holds the whole tail of the IR, rounded up to whole partitions
+        auto outputLength = inputLength + irBuffer.getNumSamples();
+        auto numBlocks = (outputLength + blockSize - 1) / blockSize;
+
+        juce::AudioBuffer<float> buffer(numChannels, numBlocks * blockSize);
+        buffer.clear();
+        reader->read(&buffer, 0, inputLength, 0, true, numInputChannels > 1);
+
+        //Output channel c uses input channel (c % inputs) and IR channel (c % IR channels)
+        for(auto ch = numInputChannels; ch < numChannels; ++ch)
+            buffer.copyFrom(ch, 0, buffer, ch % numInputChannels, 0, inputLength);
+
+        for(auto ch = 0; ch < numChannels; ++ch)
+        {
+            DynamicConvolverV2 engine;
+            if(settings.compactSpectra)
+                engine.setSpectrumStorage(DynamicConvolverV2::SpectrumStorage::compact);
+
+            //Same as the plugin's offline engines, the longest IR of a session at that block size
+            if(settings.windowGrid > 0)
+            {
+                engine.setWindowGrid(settings.windowGrid);
+                engine.prepare(blockSize, (DynamicConvolverV2::maxPartitions * settings.windowGrid + blockSize - 1) / blockSize);
+            }
+            else
+                engine.prepare(blockSize);
+            engine.setParameters(settings.filePos, settings.fileLen, settings.dryWet);
+            engine.setReverse(settings.reverse);
+
+            auto irChannel = ch % irBuffer.getNumChannels();
+            engine.loadNewIR(std::span<const float>(irBuffer.getReadPointer(irChannel), irBuffer.getNumSamples()));
+
+            auto* data = buffer.getWritePointer(ch);
+            for(auto block = 0; block < numBlocks; ++block)
+                engine.process(std::span<float>(data + block * blockSize, blockSize));
+        }
+
+        auto outputFile = getOutputFile(settings, input);
+        outputFile.deleteFile();
+
+        std::unique_ptr<juce::OutputStream> stream(outputFile.createOutputStream());
+        if(stream == nullptr)
+            return "could not write " + outputFile.getFullPathName();
+
+        juce::WavAudioFormat wavFormat;
+        std::unique_ptr<juce::AudioFormatWriter> writer(wavFormat.createWriterFor(stream.get(), reader->sampleRate,
+                                                                                  static_cast<unsigned int>(numChannels),
+                                                                                  32, {}, 0));
+        if(writer == nullptr)
+            return "could not create writer for " + outputFile.getFullPathName();
+
+        //Writer owns the stream from here on
+        stream.release();
+        writer->writeFromAudioSampleBuffer(buffer, 0, outputLength);
+        return {};
+    }
+
+    //Options that take a value, as --pos=0.5 or --pos 0.5, and those that don't
+    const juce::StringArray valueOptions {"--ir", "--pos", "--len", "--mix", "--partition", "--grid", "--threads", "--out", "--trace"};
+    const juce::StringArray flagOptions {"--compact", "--reverse", "--help", "-h"};
+
+    //Splits the arguments into options and input files, returns an error for anything it doesn't know
+    juce::String parseArguments(const juce::ArgumentList& args, std::map<juce::String, juce::String>& options,
+                                juce::Array<juce::File>& inputs)
+    {
+        for(auto i = 0; i < args.size(); ++i)
+        {
+            auto& text = args[i].text;
+
+            if(!args[i].isOption())
+            {
+                //A bare argument that isn't a file is more likely a mistyped option than an input
+                auto input = args[i].resolveAsFile();
+                if(!input.existsAsFile())
+                    return "no input file " + text;
+
+                inputs.add(input);
+                continue;
+            }
+
+            auto name = text.upToFirstOccurrenceOf("=", false, false);
+
+            if(flagOptions.contains(name))
+                options[name] = {};
+            else if(!valueOptions.contains(name))
+                return "unknown option " + name;
+            else if(text.contains("="))
+                options[name] = text.fromFirstOccurrenceOf("=", false, false);
+            else if(i + 1 < args.size() && !args[i + 1].isOption())
+                options[name] = args[++i].text;
+            else
+                return name + " needs a value";
+        }
+
+        return {};
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    juce::ArgumentList args(argc, argv);
+
+    std::map<juce::String, juce::String> options;
+    juce::Array<juce::File> inputs;
+    auto error = parseArguments(args, options, inputs);
+
+    auto hasOption = [&options](const juce::String& option) { return options.count(option) > 0; };
+
+    if(error.isNotEmpty())
+    {
+        std::cerr << "Error: " << error << "\n\n" << usage;
+        return 1;
+    }
+
+    if(hasOption("--help") || hasOption("-h"))
+    {
+        std::cout << usage;
+        return 0;
+    }
+
+    if(!hasOption("--ir") || inputs.isEmpty())
+    {
+        std::cout << usage;
+        return 1;
+    }
+
+    RenderSettings settings;
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    auto irFile = juce::File::getCurrentWorkingDirectory().getChildFile(options["--ir"]);
+    if(irFile.existsAsFile())
+        settings.ir = IRFileLoader::decodeFile(formatManager, irFile);
+
+    if(settings.ir == nullptr)
+    {
+        std::cerr << "Error: could not load IR " << irFile.getFullPathName() << "\n";
+        return 1;
+    }
+
+    auto readOption = [&options, &hasOption](const juce::String& option, float defaultValue)
+    {
+        return hasOption(option) ? options[option].getFloatValue() : defaultValue;
+    };
+
+    settings.filePos = juce::jlimit(0.0f, 1.0f, readOption("--pos", 0.0f));
+    settings.fileLen = juce::jlimit(0.0f, 1.0f, readOption("--len", 1.0f));
+    settings.dryWet = juce::jlimit(0.0f, 1.0f, readOption("--mix", 1.0f));
+
+    settings.partitionSize = juce::nextPowerOfTwo(juce::jmax(64, (int) readOption("--partition", 4096.0f)));
+
+    //Only a finer grid than the partitions changes anything
+    auto grid = hasOption("--grid") ? juce::nextPowerOfTwo(juce::jmax(16, (int) readOption("--grid", 0.0f))) : 0;
+    settings.windowGrid = grid < settings.partitionSize ? grid : 0;
+
+    settings.compactSpectra = hasOption("--compact");
+    settings.reverse = hasOption("--reverse");
+
+    auto numThreads = juce::jmax(1, (int) readOption("--threads", (float) juce::SystemStats::getNumCpus()));
+
+    if(hasOption("--out"))
+    {
+        settings.outputDir = juce::File::getCurrentWorkingDirectory().getChildFile(options["--out"]);
+        settings.outputDir.createDirectory();
+    }
+
+    std::atomic<int> numFailed{0};
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+    {
+        juce::ThreadPool pool(numThreads);
+
+        for(auto& input : inputs)
+        {
+            pool.addJob([&settings, &numFailed, input]
+            {
+                //Pool threads only record once they have a buffer of their own
+                DYNCONV_TRACE_REGISTER_THREAD();
+
+                auto error = renderFile(settings, input);
+
+                if(error.isNotEmpty())
+                {
+                    std::cerr << "Error: " << error << "\n";
+                    ++numFailed;
+                }
+                else
+                    std::cout << "Rendered " << getOutputFile(settings, input).getFullPathName() << "\n";
+            });
+        }
+
+        while(pool.getNumJobs() > 0)
+            juce::Thread::sleep(20);
+    }
+
+    if(hasOption("--trace"))
+        DynConvTrace::exportChromeTrace(juce::File::getCurrentWorkingDirectory().getChildFile(options["--trace"]));
+
+    auto elapsed = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    std::cout << "Rendered " << inputs.size() - numFailed.load() << " of " << inputs.size()
+              << " files in " << juce::String(elapsed, 2) << " s\n";
+
+    return numFailed.load() == 0 ? 0 : 1;
+}